@@ -0,0 +1,84 @@
+#ifndef AVL_CONCURRENT_H
+#define AVL_CONCURRENT_H
+
+#include "AVLTree.h"
+
+#include <shared_mutex>
+#include <mutex>
+
+// A concurrency wrapper around any AVLTree instantiation: any number of
+// readers run in parallel under a shared lock while writers take the lock
+// exclusively. This lifts the usual one-big-mutex setup to full read
+// parallelism on multi-core query boxes without touching the tree internals;
+// writers still serialize, and a writer briefly blocks readers for the
+// duration of one operation.
+//
+// Node pointers must not escape the locked region — the structure may change
+// the moment the lock is released — which is why all access goes through the
+// Read/Write functors. The convenience methods cover the common cases.
+//
+// Requires C++14 for std::shared_timed_mutex.
+template <typename TreeType> class SharedAVLTree
+{
+public:
+    typedef typename TreeType::ValueType ValueType;
+
+    SharedAVLTree() : m_tree() {}
+    explicit SharedAVLTree( const typename TreeType::ComparerType& comp ) : m_tree(comp) {}
+
+    // runs f(const TreeType&) under the shared lock; many readers may be
+    // inside concurrently
+    template <class Functor>
+    auto Read( Functor f ) const -> decltype( f( *(const TreeType*)nullptr ) )
+    {
+        std::shared_lock<std::shared_timed_mutex> lock(m_mutex);
+        return f( m_tree );
+    }
+
+    // runs f(TreeType&) under the exclusive lock
+    template <class Functor>
+    auto Write( Functor f ) -> decltype( f( *(TreeType*)nullptr ) )
+    {
+        std::unique_lock<std::shared_timed_mutex> lock(m_mutex);
+        return f( m_tree );
+    }
+
+    bool Add( const ValueType& v )
+    {
+        return Write( [&v]( TreeType& t ) { return t.Add(v); } );
+    }
+
+    bool Delete( const ValueType& v )
+    {
+        return Write( [&v]( TreeType& t ) { return t.Delete(v); } );
+    }
+
+    bool Contains( const ValueType& v ) const
+    {
+        return Read( [&v]( const TreeType& t ) {
+            const typename TreeType::Node* p = t.Find(v);
+            const typename TreeType::ComparerType& comp = t.GetComparer();
+            return p && !comp(v, p->GetKey()) && !comp(p->GetKey(), v);
+        } );
+    }
+
+    // copies the stored key equal to v into out under the shared lock;
+    // returns false if v is absent
+    bool TryGet( const ValueType& v, ValueType& out ) const
+    {
+        return Read( [&v, &out]( const TreeType& t ) {
+            const typename TreeType::Node* p = t.Find(v);
+            const typename TreeType::ComparerType& comp = t.GetComparer();
+            if( !p || comp(v, p->GetKey()) || comp(p->GetKey(), v) )
+                return false;
+            out = p->GetKey();
+            return true;
+        } );
+    }
+
+private:
+    TreeType m_tree;
+    mutable std::shared_timed_mutex m_mutex;
+};
+
+#endif
@@ -0,0 +1,299 @@
+#ifndef AVL_FROZEN_H
+#define AVL_FROZEN_H
+
+#include "AVLTree.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#define AVL_FROZEN_HAVE_MMAP 1
+#endif
+
+// A read-only, pointer-free snapshot format for AVL trees.
+//
+// FreezeToFile writes the keys in Eytzinger (BFS) order: the root at slot 0
+// and the children of slot i at 2i+1 and 2i+2. Descents are pure index
+// arithmetic over one contiguous array, so a search touches the same cache
+// lines a binary search would but with a layout that keeps the hot upper
+// levels packed together. The file needs no deserialization: FrozenAVLTree
+// can mmap it directly (the page cache then shares one physical copy across
+// processes) or attach to any caller-provided mapping.
+//
+// Only trivially copyable key types can be frozen; everything else should go
+// through an explicit serialization step first.
+
+struct FrozenAVLFileHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t count;
+    uint64_t keySize;
+};
+
+// the key array starts at this offset, which keeps it suitably aligned for
+// any reasonable key type
+const size_t FrozenAVLHeaderSize = 64;
+const uint32_t FrozenAVLMagic = 0x464C5641; // "AVLF"
+const uint32_t FrozenAVLVersion = 1;
+
+namespace FrozenAVLDetail
+{
+    // fills out[] in Eytzinger order from the sorted input by a simulated
+    // in-order walk over the implicit tree; recursion depth is O(log n)
+    template <typename T>
+    void FillEytzinger( const std::vector<T>& sorted, size_t& pos, size_t i, T* out )
+    {
+        if( i >= sorted.size() )
+            return;
+
+        FillEytzinger( sorted, pos, 2*i + 1, out );
+        out[i] = sorted[pos++];
+        FillEytzinger( sorted, pos, 2*i + 2, out );
+    }
+}
+
+// writes the contents of an AVLTree (or anything with VisitInOrder) to path
+// in the frozen snapshot format
+template <typename AVLTreeInstantiation>
+void FreezeToFile( const AVLTreeInstantiation& t, const char* path )
+{
+    typedef typename AVLTreeInstantiation::ValueType T;
+    static_assert( std::is_trivially_copyable<T>::value,
+                   "FreezeToFile requires a trivially copyable key type" );
+
+    std::vector<T> sorted;
+    t.VisitInOrder( [&sorted]( const T& v ) { sorted.push_back(v); } );
+
+    std::vector<T> laid( sorted.size() );
+    size_t pos = 0;
+    FrozenAVLDetail::FillEytzinger( sorted, pos, 0, laid.data() );
+
+    FrozenAVLFileHeader hdr = {};
+    hdr.magic = FrozenAVLMagic;
+    hdr.version = FrozenAVLVersion;
+    hdr.count = sorted.size();
+    hdr.keySize = sizeof(T);
+
+    char padding[FrozenAVLHeaderSize] = {};
+    std::memcpy( padding, &hdr, sizeof(hdr) );
+
+    FILE* f = std::fopen( path, "wb" );
+    if( !f )
+        throw std::runtime_error( std::string("FreezeToFile: cannot open ") + path );
+
+    bool ok = std::fwrite( padding, 1, FrozenAVLHeaderSize, f ) == FrozenAVLHeaderSize;
+    if( ok && !laid.empty() )
+        ok = std::fwrite( laid.data(), sizeof(T), laid.size(), f ) == laid.size();
+    ok = (std::fclose(f) == 0) && ok;
+
+    if( !ok )
+        throw std::runtime_error( std::string("FreezeToFile: write failed for ") + path );
+}
+
+// a read-only view over a frozen snapshot; movable but not copyable, and
+// unmaps/frees whatever backing storage it owns on destruction
+template <typename T, typename Comparer = std::less<T>> class FrozenAVLTree
+{
+public:
+    static_assert( std::is_trivially_copyable<T>::value,
+                   "FrozenAVLTree requires a trivially copyable key type" );
+
+    FrozenAVLTree() : m_keys(nullptr), m_count(0), m_mapBase(nullptr), m_mapLen(0), m_comp() {}
+
+    FrozenAVLTree( FrozenAVLTree&& o )
+        : m_keys(o.m_keys), m_count(o.m_count), m_heap(std::move(o.m_heap)),
+          m_mapBase(o.m_mapBase), m_mapLen(o.m_mapLen), m_comp(o.m_comp)
+    {
+        o.m_keys = nullptr;
+        o.m_count = 0;
+        o.m_mapBase = nullptr;
+        o.m_mapLen = 0;
+    }
+
+    FrozenAVLTree& operator=( FrozenAVLTree&& o )
+    {
+        if( this != &o )
+        {
+            Release();
+            m_keys = o.m_keys; m_count = o.m_count; m_heap = std::move(o.m_heap);
+            m_mapBase = o.m_mapBase; m_mapLen = o.m_mapLen; m_comp = o.m_comp;
+            o.m_keys = nullptr; o.m_count = 0; o.m_mapBase = nullptr; o.m_mapLen = 0;
+        }
+        return *this;
+    }
+
+    FrozenAVLTree( const FrozenAVLTree& ) = delete;
+    FrozenAVLTree& operator=( const FrozenAVLTree& ) = delete;
+
+    ~FrozenAVLTree() { Release(); }
+
+    // memory-maps path when the platform allows it and falls back to reading
+    // the file into memory otherwise
+    static FrozenAVLTree LoadFrozen( const char* path, const Comparer& comp = Comparer() )
+    {
+#ifdef AVL_FROZEN_HAVE_MMAP
+        int fd = ::open( path, O_RDONLY );
+        if( fd < 0 )
+            throw std::runtime_error( std::string("LoadFrozen: cannot open ") + path );
+
+        struct stat st;
+        if( ::fstat( fd, &st ) != 0 )
+        {
+            ::close(fd);
+            throw std::runtime_error( std::string("LoadFrozen: cannot stat ") + path );
+        }
+
+        size_t len = size_t(st.st_size);
+        void* base = ::mmap( nullptr, len, PROT_READ, MAP_SHARED, fd, 0 );
+        ::close(fd);
+        if( base == MAP_FAILED )
+            throw std::runtime_error( std::string("LoadFrozen: mmap failed for ") + path );
+
+        FrozenAVLTree t( comp );
+        try
+        {
+            t = AttachToMemory( base, len, comp );
+        }
+        catch( ... )
+        {
+            // nothing owns the mapping until AttachToMemory succeeds
+            ::munmap( base, len );
+            throw;
+        }
+        t.m_mapBase = base;
+        t.m_mapLen = len;
+        return t;
+#else
+        FILE* f = std::fopen( path, "rb" );
+        if( !f )
+            throw std::runtime_error( std::string("LoadFrozen: cannot open ") + path );
+
+        std::fseek( f, 0, SEEK_END );
+        long len = std::ftell( f );
+        std::fseek( f, 0, SEEK_SET );
+
+        std::vector<char> buf( size_t(len) );
+        bool ok = std::fread( buf.data(), 1, buf.size(), f ) == buf.size();
+        std::fclose(f);
+        if( !ok )
+            throw std::runtime_error( std::string("LoadFrozen: read failed for ") + path );
+
+        FrozenAVLTree t = AttachToMemory( buf.data(), buf.size(), comp );
+        t.m_heap.swap( buf );
+        t.m_keys = reinterpret_cast<const T*>( t.m_heap.data() + FrozenAVLHeaderSize );
+        return t;
+#endif
+    }
+
+    // zero-copy view over an existing mapping; the caller keeps ownership of
+    // the memory, which must outlive the returned view
+    static FrozenAVLTree AttachToMemory( const void* data, size_t bytes, const Comparer& comp = Comparer() )
+    {
+        if( bytes < FrozenAVLHeaderSize )
+            throw std::runtime_error( "FrozenAVLTree: snapshot is truncated" );
+
+        FrozenAVLFileHeader hdr;
+        std::memcpy( &hdr, data, sizeof(hdr) );
+        if( hdr.magic != FrozenAVLMagic || hdr.version != FrozenAVLVersion )
+            throw std::runtime_error( "FrozenAVLTree: not a frozen AVL snapshot" );
+        if( hdr.keySize != sizeof(T) )
+            throw std::runtime_error( "FrozenAVLTree: key size mismatch" );
+        // divide rather than multiply: a corrupt count must not be able to
+        // overflow the size computation past the truncation check
+        if( hdr.count > ( bytes - FrozenAVLHeaderSize ) / sizeof(T) )
+            throw std::runtime_error( "FrozenAVLTree: snapshot is truncated" );
+
+        FrozenAVLTree t( comp );
+        t.m_keys = reinterpret_cast<const T*>( static_cast<const char*>(data) + FrozenAVLHeaderSize );
+        t.m_count = size_t(hdr.count);
+        return t;
+    }
+
+    size_t GetCount() const { return m_count; }
+
+    // returns a pointer to the stored key equal to v, or nullptr
+    const T* Find( const T& v ) const
+    {
+        size_t i = 0;
+        while( i < m_count )
+        {
+            if( m_comp( v, m_keys[i] ) )
+                i = 2*i + 1;
+            else if( m_comp( m_keys[i], v ) )
+                i = 2*i + 2;
+            else
+                return &m_keys[i];
+        }
+        return nullptr;
+    }
+
+    // returns a pointer to the smallest stored key that is not less than v,
+    // or nullptr if every key is smaller
+    const T* LowerBound( const T& v ) const
+    {
+        const T* candidate = nullptr;
+        size_t i = 0;
+        while( i < m_count )
+        {
+            if( m_comp( m_keys[i], v ) )
+                i = 2*i + 2;
+            else
+            {
+                candidate = &m_keys[i];
+                i = 2*i + 1;
+            }
+        }
+        return candidate;
+    }
+
+    template <class Functor>
+    void VisitInOrder( Functor f ) const
+    {
+        VisitInOrderImpl( f, 0 );
+    }
+
+private:
+    FrozenAVLTree( const Comparer& comp )
+        : m_keys(nullptr), m_count(0), m_mapBase(nullptr), m_mapLen(0), m_comp(comp) {}
+
+    template <class Functor>
+    void VisitInOrderImpl( Functor f, size_t i ) const // recursion depth is O(log n)
+    {
+        if( i >= m_count )
+            return;
+
+        VisitInOrderImpl( f, 2*i + 1 );
+        f( m_keys[i] );
+        VisitInOrderImpl( f, 2*i + 2 );
+    }
+
+    void Release()
+    {
+#ifdef AVL_FROZEN_HAVE_MMAP
+        if( m_mapBase )
+            ::munmap( m_mapBase, m_mapLen );
+#endif
+        m_mapBase = nullptr;
+        m_mapLen = 0;
+        m_keys = nullptr;
+        m_count = 0;
+    }
+
+    const T* m_keys;
+    size_t m_count;
+    std::vector<char> m_heap; // backing storage for the no-mmap fallback
+    void* m_mapBase;
+    size_t m_mapLen;
+    Comparer m_comp;
+};
+
+#endif
@@ -0,0 +1,120 @@
+#ifndef AVL_MAP_H
+#define AVL_MAP_H
+
+#include "AVLTree.h"
+
+// A key/value layer over AVLTree that stores each entry as one
+// std::pair<Key, Value> node and compares entries by key only. The entry
+// comparer is transparent, so every lookup goes through the tree's
+// heterogeneous overloads with the bare key (or any probe type the user's
+// Comparer accepts transparently) — no pair is ever constructed just to
+// probe, which is what matters when Value is large.
+//
+// The map exposes the common point operations directly; everything else
+// (visits, cursors, Split/MergeWith, batch operations) is reached through
+// GetTree(). Note that mutating an entry's Value through TryGet or
+// operator[] is fine, but its Key must never be changed in place.
+template <typename Key, typename Value, typename Comparer = std::less<Key>,
+          template <typename> class NodeBase = DefaultNodeBaseType,
+          class NodeAllocator = NewDeleteNodeAllocator>
+class AVLMap
+{
+public:
+    typedef Key KeyType;
+    typedef Value MappedType;
+    typedef std::pair<Key, Value> EntryType;
+
+    // orders entries by key and lets bare keys (and, when Comparer is itself
+    // transparent, arbitrary probe types) through without building an entry
+    class EntryComparer
+    {
+    public:
+        typedef void is_transparent;
+
+        EntryComparer() : m_comp() {}
+        explicit EntryComparer( const Comparer& comp ) : m_comp(comp) {}
+
+        const Comparer& GetKeyComparer() const { return m_comp; }
+
+        bool operator()( const EntryType& a, const EntryType& b ) const { return m_comp(a.first, b.first); }
+        template <class K>
+        bool operator()( const EntryType& a, const K& k ) const { return m_comp(a.first, k); }
+        template <class K>
+        bool operator()( const K& k, const EntryType& b ) const { return m_comp(k, b.first); }
+
+    private:
+        Comparer m_comp;
+    };
+
+    typedef AVLTree<EntryType, EntryComparer, NodeBase<EntryType>, NodeAllocator> TreeType;
+    typedef typename TreeType::Node Node;
+
+    AVLMap() : m_tree() {}
+    explicit AVLMap( const Comparer& comp ) : m_tree( EntryComparer(comp) ) {}
+
+    // the underlying tree, for everything the map does not wrap
+    TreeType& GetTree() { return m_tree; }
+    const TreeType& GetTree() const { return m_tree; }
+
+    // inserts (key, value) if the key is absent; returns whether it was added
+    bool Insert( const Key& key, const Value& value ) { return m_tree.Emplace( key, value ); }
+    bool Insert( Key&& key, Value&& value )
+    {
+        return m_tree.Emplace( std::move(key), std::move(value) );
+    }
+
+    // inserts or overwrites; returns true when the key was newly added
+    bool InsertOrAssign( const Key& key, const Value& value )
+    {
+        Node* p = m_tree.FindExact( key );
+        if( p )
+        {
+            const_cast<EntryType&>( p->GetKey() ).second = value;
+            return false;
+        }
+        return m_tree.Emplace( key, value );
+    }
+
+    // pointer to the mapped value, or nullptr when the key is absent; the
+    // probe type only needs to be comparable against Key by the Comparer
+    template <class K>
+    Value* TryGet( const K& key )
+    {
+        Node* p = m_tree.FindExact( key );
+        return p ? &const_cast<EntryType&>( p->GetKey() ).second : nullptr;
+    }
+    template <class K>
+    const Value* TryGet( const K& key ) const
+    {
+        const Node* p = m_tree.FindExact( key );
+        return p ? &p->GetKey().second : nullptr;
+    }
+
+    // the mapped value for key, default-constructing it on first access
+    Value& operator[]( const Key& key )
+    {
+        Value* v = TryGet( key );
+        if( v )
+            return *v;
+        m_tree.Emplace( key, Value() );
+        return *TryGet( key );
+    }
+
+    template <class K>
+    bool Contains( const K& key ) const { return m_tree.FindExact( key ) != nullptr; }
+
+    template <class K>
+    bool Erase( const K& key ) { return m_tree.Delete( key ); }
+
+    // applies f(const Key&, const Value&) in ascending key order
+    template <class Functor>
+    void VisitInOrder( Functor f ) const
+    {
+        m_tree.VisitInOrder( [&f]( const EntryType& e ) { f( e.first, e.second ); } );
+    }
+
+private:
+    TreeType m_tree;
+};
+
+#endif
@@ -0,0 +1,221 @@
+#ifndef AVL_PACKED_H
+#define AVL_PACKED_H
+
+#include "AVLTree.h"
+
+// A hybrid set for small keys: instead of one tree node per key, keys live in
+// packed sorted-array blocks of up to BlockCapacity elements, and the AVL
+// tree orders the blocks by their smallest key. Point operations descend the
+// (BlockCapacity times smaller) tree and finish with a binary search inside
+// one contiguous block, so a subtree's worth of pointer chasing and per-node
+// allocation collapses into a couple of cache lines; blocks split on
+// overflow and merge with their successor on underflow, B-tree style.
+//
+// Block ranges are disjoint and a block's recorded minimum never moves
+// outside its range, so mutating a block in place never perturbs the tree
+// order. The per-key node handles of AVLTree do not exist here — lookups
+// return pointers to keys inside blocks, valid only until the next
+// modification.
+template <typename T, typename Comparer = std::less<T>, size_t BlockCapacity = 64>
+class PackedAVLTree
+{
+    static_assert( BlockCapacity >= 4, "blocks this small defeat the packing" );
+
+public:
+    typedef T ValueType;
+    typedef Comparer ComparerType;
+
+    struct Block
+    {
+        explicit Block( const T& v ) : minKey(v), keys(1, v) {}
+        Block( const T& low, std::vector<T> ks ) : minKey(low), keys( std::move(ks) ) {}
+
+        // kept equal to keys.front() while the block is live; deliberately
+        // left untouched when the block is emptied right before its tree node
+        // is deleted, so the comparator stays safe during that descent
+        T minKey;
+        std::vector<T> keys;
+    };
+
+    // orders blocks by their minimum and lets bare keys probe transparently
+    class BlockComparer
+    {
+    public:
+        typedef void is_transparent;
+
+        BlockComparer() : m_comp() {}
+        explicit BlockComparer( const Comparer& comp ) : m_comp(comp) {}
+
+        const Comparer& GetKeyComparer() const { return m_comp; }
+
+        bool operator()( const Block& a, const Block& b ) const { return m_comp(a.minKey, b.minKey); }
+        bool operator()( const Block& a, const T& k ) const { return m_comp(a.minKey, k); }
+        bool operator()( const T& k, const Block& b ) const { return m_comp(k, b.minKey); }
+
+    private:
+        Comparer m_comp;
+    };
+
+    typedef AVLTree<Block, BlockComparer> TreeType;
+    typedef typename TreeType::Node BlockNode;
+
+    PackedAVLTree() : m_tree(), m_comp(), m_count(0) {}
+    explicit PackedAVLTree( const Comparer& comp )
+        : m_tree( BlockComparer(comp) ), m_comp(comp), m_count(0) {}
+
+    size_t GetCount() const { return m_count; }
+
+    // pointer to the stored key equal to v, or nullptr; valid only until the
+    // next modification
+    const T* Find( const T& v ) const
+    {
+        const BlockNode* n = LocateBlock(v);
+        if( !n )
+            return nullptr;
+        const std::vector<T>& ks = n->GetKey().keys;
+        auto it = std::lower_bound( ks.begin(), ks.end(), v, m_comp );
+        if( it != ks.end() && !m_comp(v, *it) )
+            return &*it;
+        return nullptr;
+    }
+
+    bool Add( const T& v )
+    {
+        BlockNode* n = LocateBlock(v);
+        if( !n )
+        {
+            m_tree.Emplace( v );
+            ++m_count;
+            return true;
+        }
+
+        Block& b = MutableBlock(n);
+        auto it = std::lower_bound( b.keys.begin(), b.keys.end(), v, m_comp );
+        if( it != b.keys.end() && !m_comp(v, *it) )
+            return false; // already present
+
+        b.keys.insert( it, v );
+        if( m_comp(v, b.minKey) )
+            b.minKey = v; // only possible in the very first block
+        ++m_count;
+
+        if( b.keys.size() > BlockCapacity )
+            SplitBlock(b);
+        return true;
+    }
+
+    bool Delete( const T& v )
+    {
+        BlockNode* n = LocateBlock(v);
+        if( !n )
+            return false;
+
+        Block& b = MutableBlock(n);
+        auto it = std::lower_bound( b.keys.begin(), b.keys.end(), v, m_comp );
+        if( it == b.keys.end() || m_comp(v, *it) )
+            return false;
+
+        b.keys.erase(it);
+        --m_count;
+
+        if( b.keys.empty() )
+            m_tree.Delete( b.minKey ); // minKey still identifies the block
+        else
+        {
+            b.minKey = b.keys.front();
+            if( b.keys.size() < BlockCapacity / 4 )
+                TryMergeWithSuccessor(n);
+        }
+        return true;
+    }
+
+    const T* GetMin() const
+    {
+        const BlockNode* n = m_tree.GetMin();
+        return n ? &n->GetKey().keys.front() : nullptr;
+    }
+
+    const T* GetMax() const
+    {
+        const BlockNode* n = m_tree.GetMax();
+        return n ? &n->GetKey().keys.back() : nullptr;
+    }
+
+    // applies f(const T&) to every key in ascending order; within a block
+    // this is a linear scan over contiguous memory
+    template <class Functor>
+    void VisitInOrder( Functor f ) const
+    {
+        m_tree.VisitInOrder( [&f]( const Block& b )
+        {
+            for( const T& k : b.keys )
+                f(k);
+        } );
+    }
+
+    // the block tree, for diagnostics (block count, occupancy)
+    const TreeType& GetTree() const { return m_tree; }
+
+private:
+    // blocks are value-mutated in place through their const node handles, the
+    // same way AVLMap mutates its payloads; the tree order is unaffected
+    // because block ranges stay disjoint
+    static Block& MutableBlock( BlockNode* n )
+    {
+        return const_cast<Block&>( n->GetKey() );
+    }
+
+    // the block whose range would contain v: the last block whose minimum is
+    // not greater than v (or the first block when v precedes all of them,
+    // nullptr only for an empty tree)
+    const BlockNode* LocateBlock( const T& v ) const
+    {
+        const BlockNode* n = m_tree.LowerBound(v);
+        if( n && !m_comp( v, n->GetKey().minKey ) )
+            return n; // v equals this block's minimum
+        const BlockNode* prev = n ? m_tree.GetPrev(n) : m_tree.GetMax();
+        return prev ? prev : n;
+    }
+    BlockNode* LocateBlock( const T& v )
+    {
+        return const_cast<BlockNode*>(
+            static_cast<const PackedAVLTree*>(this)->LocateBlock(v) );
+    }
+
+    // overflow: the upper half moves into a fresh block of its own
+    void SplitBlock( Block& b )
+    {
+        size_t half = b.keys.size() / 2;
+        std::vector<T> upper( std::make_move_iterator( b.keys.begin() + half ),
+                              std::make_move_iterator( b.keys.end() ) );
+        b.keys.resize( half );
+        T upperMin = upper.front();
+        m_tree.Emplace( std::move(upperMin), std::move(upper) );
+    }
+
+    // underflow: pull the successor block in if the union still fits,
+    // then drop the successor's (now empty, but still ordered) node
+    void TryMergeWithSuccessor( BlockNode* n )
+    {
+        BlockNode* succ = m_tree.GetNext(n);
+        if( !succ )
+            return;
+
+        Block& b = MutableBlock(n);
+        Block& s = MutableBlock(succ);
+        if( b.keys.size() + s.keys.size() > BlockCapacity )
+            return;
+
+        b.keys.insert( b.keys.end(),
+                       std::make_move_iterator( s.keys.begin() ),
+                       std::make_move_iterator( s.keys.end() ) );
+        s.keys.clear();
+        m_tree.Delete( s.minKey );
+    }
+
+    TreeType m_tree;
+    Comparer m_comp;
+    size_t m_count;
+};
+
+#endif
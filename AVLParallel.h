@@ -0,0 +1,154 @@
+#ifndef AVL_PARALLEL_H
+#define AVL_PARALLEL_H
+
+#include "AVLTree.h"
+
+#include <future>
+#include <thread>
+#include <vector>
+
+// Parallel helpers for multi-core work over AVL trees.
+
+// Merges a sequence of trees with pairwise-disjoint ascending key ranges
+// (every key of trees[i] less than every key of trees[i+1], the same
+// precondition as MergeWith) into trees[0], leaving the other slots empty.
+//
+// Instead of a left fold, the trees are combined as a balanced reduction:
+// at each level disjoint neighbour pairs merge concurrently via std::async,
+// so reducing k per-core shard trees takes O(log k) levels of parallel
+// O(logN) joins rather than k serialized ones. MergeWith only relinks
+// existing nodes — it neither allocates nor destroys — so the concurrent
+// pair merges are safe with any NodeAllocator, including the pool.
+//
+// maxThreads caps the number of additional threads per reduction level;
+// 1 (or hardware_concurrency reporting 0) degrades to a purely sequential
+// balanced reduction.
+template <typename TreeType>
+void MergeAllParallel( TreeType* trees, size_t count,
+                       size_t maxThreads = std::thread::hardware_concurrency() )
+{
+    if( count <= 1 )
+        return;
+    if( maxThreads == 0 )
+        maxThreads = 1;
+
+    for( size_t stride = 1; stride < count; stride *= 2 )
+    {
+        std::vector<std::future<void>> tasks;
+
+        for( size_t i = 0; i + stride < count; i += 2*stride )
+        {
+            TreeType& dst = trees[i];
+            TreeType& src = trees[i + stride];
+
+            if( maxThreads > 1 && tasks.size() + 1 < maxThreads )
+                tasks.push_back( std::async( std::launch::async,
+                    [&dst, &src]() { dst.MergeWith(src); } ) );
+            else
+                dst.MergeWith(src);
+        }
+
+        for( std::future<void>& f : tasks )
+            f.get();
+    }
+}
+
+// sequential in-order fold over one subtree; the small-subtree leaf case of
+// the parallel traversals below
+template <typename NodeT, class Functor>
+void VisitSubtreeInOrder( const NodeT* p, Functor& f )
+{
+    if( !p )
+        return;
+    VisitSubtreeInOrder( p->GetChild(0), f );
+    f( p->GetKey() );
+    VisitSubtreeInOrder( p->GetChild(1), f );
+}
+
+// threadBudget counts the extra threads this subtree may still spawn; each
+// fork hands half of the remainder to the spawned side
+template <typename NodeT, class Functor>
+void VisitInOrderParallelImpl( const NodeT* p, const Functor& f, size_t grainHeight, size_t threadBudget )
+{
+    if( !p )
+        return;
+
+    if( threadBudget == 0 || p->GetHeight() <= grainHeight )
+    {
+        VisitSubtreeInOrder( p, f );
+        return;
+    }
+
+    size_t leftBudget = (threadBudget - 1) / 2;
+    std::future<void> left = std::async( std::launch::async,
+        [p, &f, grainHeight, leftBudget]()
+        { VisitInOrderParallelImpl( p->GetChild(0), f, grainHeight, leftBudget ); } );
+
+    f( p->GetKey() );
+    VisitInOrderParallelImpl( p->GetChild(1), f, grainHeight, threadBudget - 1 - leftBudget );
+    left.get();
+}
+
+// Applies f(const T&) to every key, visiting independent subtrees
+// concurrently. Subtrees of height at most grainHeight run sequentially on
+// one thread, so grainHeight trades scheduling overhead against parallelism
+// (each task covers up to ~2^grainHeight keys). Keys within one task arrive
+// in ascending order, but tasks run concurrently, so there is NO global
+// ordering and f must be safe to call from several threads at once. For a
+// deterministic combined result use ReduceInOrderParallel instead.
+template <typename TreeType, class Functor>
+void VisitInOrderParallel( const TreeType& t, Functor f, size_t grainHeight,
+                           size_t maxThreads = std::thread::hardware_concurrency() )
+{
+    VisitInOrderParallelImpl( t.GetRoot(), f, grainHeight,
+                              maxThreads > 0 ? maxThreads - 1 : 0 );
+}
+
+template <typename NodeT, typename R, class Lift, class Combine>
+R ReduceInOrderParallelImpl( const NodeT* p, const R& identity, const Lift& lift,
+                             const Combine& combine, size_t grainHeight, size_t threadBudget )
+{
+    if( !p )
+        return identity;
+
+    if( threadBudget == 0 || p->GetHeight() <= grainHeight )
+    {
+        R acc = identity;
+        auto fold = [&acc, &combine, &lift]( const decltype(p->GetKey())& k )
+            { acc = combine( std::move(acc), lift(k) ); };
+        VisitSubtreeInOrder( p, fold );
+        return acc;
+    }
+
+    size_t leftBudget = (threadBudget - 1) / 2;
+    std::future<R> left = std::async( std::launch::async,
+        [p, &identity, &lift, &combine, grainHeight, leftBudget]()
+        { return ReduceInOrderParallelImpl( p->GetChild(0), identity, lift, combine,
+                                            grainHeight, leftBudget ); } );
+
+    R mid = lift( p->GetKey() );
+    R right = ReduceInOrderParallelImpl( p->GetChild(1), identity, lift, combine,
+                                         grainHeight, threadBudget - 1 - leftBudget );
+
+    // combined strictly in key order, so any associative combine reproduces
+    // the sequential left fold exactly
+    return combine( combine( left.get(), std::move(mid) ), std::move(right) );
+}
+
+// Ordered parallel reduction: folds lift(key) over all keys in ascending
+// order with an associative combine, computing independent subtrees
+// concurrently and joining the partial results in key order. For an
+// associative combine the result is identical to the sequential
+// fold — e.g. the summation behind SumNodeBaseType, min/max, or string-free
+// histogram merges. lift and combine are called from several threads and
+// must not share mutable state; identity must be a true identity of combine.
+template <typename TreeType, typename R, class Lift, class Combine>
+R ReduceInOrderParallel( const TreeType& t, R identity, Lift lift, Combine combine,
+                         size_t grainHeight,
+                         size_t maxThreads = std::thread::hardware_concurrency() )
+{
+    return ReduceInOrderParallelImpl( t.GetRoot(), identity, lift, combine, grainHeight,
+                                      maxThreads > 0 ? maxThreads - 1 : 0 );
+}
+
+#endif
@@ -0,0 +1,222 @@
+#ifndef AVL_PERSISTENT_H
+#define AVL_PERSISTENT_H
+
+#include <functional>
+#include <memory>
+#include <utility>
+#include <cassert>
+
+// A persistent (immutable) AVL tree: every node is frozen at construction and
+// children are held through std::shared_ptr<const Node>, so Add and Delete
+// copy only the O(logN) path they touch and return a NEW tree sharing every
+// untouched subtree with the old one. Taking a snapshot is therefore a plain
+// copy of the tree object — one root-pointer grab — and the memory overhead
+// of keeping a snapshot alive is O(updates since), not O(n).
+//
+// The intended pattern is one writer advancing its current tree value while
+// readers copy snapshots and query them without any locking: the nodes a
+// snapshot reaches can never change, and shared_ptr's refcounting is atomic.
+// Publishing the writer's latest tree to the readers is the one hand-off
+// that still needs synchronization (a mutex around the copy, or
+// std::atomic_store on a shared root).
+//
+// There are no parent pointers — a shared subtree has many parents — so the
+// node walks here are recursive; the depth is bounded by the AVL height.
+template <typename T, typename Comparer = std::less<T>>
+class PersistentAVLTree
+{
+public:
+    typedef T ValueType;
+    typedef Comparer ComparerType;
+
+    class Node;
+    typedef std::shared_ptr<const Node> NodePtr;
+
+    class Node
+    {
+    public:
+        Node( const T& v, NodePtr l, NodePtr r )
+            : key(v), children{ std::move(l), std::move(r) },
+              height( 1 + std::max( Height(children[0]), Height(children[1]) ) ) {}
+
+        size_t GetHeight() const { return height; }
+        const T& GetKey() const { return key; }
+        const Node* GetChild( size_t i ) const { return children[i].get(); }
+
+    private:
+        friend class PersistentAVLTree;
+
+        const T key;
+        const NodePtr children[2];
+        const size_t height;
+    };
+
+    PersistentAVLTree() : m_root(), m_count(0), m_comp() {}
+    explicit PersistentAVLTree( const Comparer& comp ) : m_root(), m_count(0), m_comp(comp) {}
+
+    const Node* GetRoot() const { return m_root.get(); }
+    size_t GetCount() const { return m_count; }
+
+    // returns the node containing v, or nullptr when v is absent
+    const Node* Find( const T& v ) const
+    {
+        const Node* p = m_root.get();
+        while( p )
+        {
+            if( m_comp( v, p->key ) )
+                p = p->children[0].get();
+            else if( m_comp( p->key, v ) )
+                p = p->children[1].get();
+            else
+                return p;
+        }
+        return nullptr;
+    }
+
+    // returns a new tree containing v; this tree is unchanged. When v is
+    // already present the result shares the root (no copies at all).
+    PersistentAVLTree Add( const T& v ) const
+    {
+        bool added = false;
+        NodePtr root = AddImpl( m_root, v, added );
+        return PersistentAVLTree( std::move(root), m_count + (added ? 1 : 0), m_comp );
+    }
+
+    // returns a new tree without v; shares the root when v was absent
+    PersistentAVLTree Delete( const T& v ) const
+    {
+        bool deleted = false;
+        NodePtr root = DeleteImpl( m_root, v, deleted );
+        return PersistentAVLTree( std::move(root), m_count - (deleted ? 1 : 0), m_comp );
+    }
+
+    template <class Functor>
+    void VisitInOrder( Functor f ) const
+    {
+        VisitInOrderImpl( m_root.get(), f );
+    }
+
+private:
+    PersistentAVLTree( NodePtr root, size_t count, const Comparer& comp )
+        : m_root( std::move(root) ), m_count(count), m_comp(comp) {}
+
+    static size_t Height( const NodePtr& p ) { return p ? p->height : 0; }
+
+    static NodePtr MakeNode( const T& v, NodePtr l, NodePtr r )
+    {
+        return std::make_shared<const Node>( v, std::move(l), std::move(r) );
+    }
+
+    // builds the node (key, l, r), restoring the AVL invariant with freshly
+    // built rotation nodes when the children's heights differ by two — the
+    // most an insert or delete below can cause
+    static NodePtr Balance( const T& key, NodePtr l, NodePtr r )
+    {
+        if( Height(l) > Height(r) + 1 )
+        {
+            assert( Height(l) == Height(r) + 2 );
+            if( Height(l->children[0]) >= Height(l->children[1]) )
+                return MakeNode( l->key, l->children[0],
+                                 MakeNode( key, l->children[1], std::move(r) ) );
+            const NodePtr& pivot = l->children[1];
+            return MakeNode( pivot->key,
+                             MakeNode( l->key, l->children[0], pivot->children[0] ),
+                             MakeNode( key, pivot->children[1], std::move(r) ) );
+        }
+        if( Height(r) > Height(l) + 1 )
+        {
+            assert( Height(r) == Height(l) + 2 );
+            if( Height(r->children[1]) >= Height(r->children[0]) )
+                return MakeNode( r->key,
+                                 MakeNode( key, std::move(l), r->children[0] ),
+                                 r->children[1] );
+            const NodePtr& pivot = r->children[0];
+            return MakeNode( pivot->key,
+                             MakeNode( key, std::move(l), pivot->children[0] ),
+                             MakeNode( r->key, pivot->children[1], r->children[1] ) );
+        }
+        return MakeNode( key, std::move(l), std::move(r) );
+    }
+
+    NodePtr AddImpl( const NodePtr& p, const T& v, bool& added ) const
+    {
+        if( !p )
+        {
+            added = true;
+            return MakeNode( v, nullptr, nullptr );
+        }
+
+        if( m_comp( v, p->key ) )
+        {
+            NodePtr nl = AddImpl( p->children[0], v, added );
+            if( !added )
+                return p;
+            return Balance( p->key, std::move(nl), p->children[1] );
+        }
+        if( m_comp( p->key, v ) )
+        {
+            NodePtr nr = AddImpl( p->children[1], v, added );
+            if( !added )
+                return p;
+            return Balance( p->key, p->children[0], std::move(nr) );
+        }
+        return p; // already present: the whole tree is shared
+    }
+
+    // removes the leftmost node of the non-empty subtree p
+    static NodePtr RemoveMin( const NodePtr& p )
+    {
+        if( !p->children[0] )
+            return p->children[1];
+        return Balance( p->key, RemoveMin( p->children[0] ), p->children[1] );
+    }
+
+    NodePtr DeleteImpl( const NodePtr& p, const T& v, bool& deleted ) const
+    {
+        if( !p )
+            return p;
+
+        if( m_comp( v, p->key ) )
+        {
+            NodePtr nl = DeleteImpl( p->children[0], v, deleted );
+            if( !deleted )
+                return p;
+            return Balance( p->key, std::move(nl), p->children[1] );
+        }
+        if( m_comp( p->key, v ) )
+        {
+            NodePtr nr = DeleteImpl( p->children[1], v, deleted );
+            if( !deleted )
+                return p;
+            return Balance( p->key, p->children[0], std::move(nr) );
+        }
+
+        deleted = true;
+        if( !p->children[0] )
+            return p->children[1];
+        if( !p->children[1] )
+            return p->children[0];
+
+        // two children: the in-order successor's key takes p's place
+        const Node* m = p->children[1].get();
+        while( m->children[0] )
+            m = m->children[0].get();
+        return Balance( m->key, p->children[0], RemoveMin( p->children[1] ) );
+    }
+
+    template <class Functor>
+    static void VisitInOrderImpl( const Node* p, Functor& f )
+    {
+        if( !p )
+            return;
+        VisitInOrderImpl( p->children[0].get(), f );
+        f( p->key );
+        VisitInOrderImpl( p->children[1].get(), f );
+    }
+
+    NodePtr m_root;
+    size_t m_count;
+    Comparer m_comp;
+};
+
+#endif
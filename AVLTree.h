@@ -4,33 +4,257 @@
 #include <algorithm>
 #include <functional>
 #include <type_traits>
+#include <iterator>
 #include <memory>
+#include <new>
+#include <utility>
+#include <vector>
 #include <cassert>
 #include <stdexcept>
 
+#if defined(__GNUC__) || defined(__clang__)
+#define AVL_PREFETCH(p) __builtin_prefetch(p)
+#else
+#define AVL_PREFETCH(p) ((void)0)
+#endif
+
 template <typename ValueType> struct DefaultNodeBaseType
 {
     DefaultNodeBaseType(const ValueType& ) {}
     void UpdateNodeState( const ValueType& v, DefaultNodeBaseType* p1, DefaultNodeBaseType* p2 ) {}
 };
 
-template <typename T, typename Comparer = std::less<T>, class NodeBaseType = DefaultNodeBaseType<T>> class AVLTree
+// compile-time detection of NodeBaseTypes that maintain in-order succ/pred
+// links (see LinkedNodeBaseType in AVLUtils.h). When such a base is used the
+// tree keeps the links up to date across Add/Delete/Split/MergeWith and
+// GetNext/GetPrev become a single pointer dereference.
+template <typename B> class NodeBaseHasOrderedLinks
+{
+    template <typename U> static std::true_type Test( decltype(((U*)nullptr)->GetSucc())* );
+    template <typename U> static std::false_type Test(...);
+public:
+    static const bool value = decltype(Test<B>(nullptr))::value;
+};
+
+// compile-time detection of NodeBaseTypes that maintain subtree sizes via a
+// GetSize() accessor (see TreeSizeNodeBaseType in AVLUtils.h); required by the
+// order-statistic operations SplitAtIndex and GetRank
+template <typename B> class NodeBaseHasSize
+{
+    template <typename U> static std::true_type Test( decltype(((const U*)nullptr)->GetSize())* );
+    template <typename U> static std::false_type Test(...);
+public:
+    static const bool value = decltype(Test<B>(nullptr))::value;
+};
+
+// compile-time detection of NodeBaseTypes caching a subtree sum behind a
+// GetSum() accessor (see SumNodeBaseType in AVLUtils.h); lets generic code
+// such as ValidateInvariants recheck the cached aggregate when one exists
+template <typename B> class NodeBaseHasSum
+{
+    template <typename U> static std::true_type Test( decltype(((const U*)nullptr)->GetSum())* );
+    template <typename U> static std::false_type Test(...);
+public:
+    static const bool value = decltype(Test<B>(nullptr))::value;
+};
+
+// compile-time detection of NodeBaseTypes that carry no per-subtree state at
+// all (the default). For those, UpdateNodeState maintains nothing beyond the
+// height, so the upward pass of a structural update may stop as soon as a
+// subtree's height comes out unchanged — nothing above can be affected.
+// Augmented bases (sizes, sums, links, dirty bits) are not empty and keep the
+// full root-path update their aggregates require.
+template <typename B> class NodeBaseIsHeightOnly
+{
+public:
+    static const bool value = std::is_empty<B>::value;
+};
+
+// compile-time detection of NodeBaseTypes that defer their aggregate
+// recomputation behind a dirty bit (see LazyAggregateNodeBaseType in
+// AVLUtils.h); enables AVLTree::FlushAggregates
+template <typename B> class NodeBaseHasLazyAggregates
+{
+    template <typename U> static std::true_type Test( decltype(((const U*)nullptr)->IsAggregateDirty())* );
+    template <typename U> static std::false_type Test(...);
+public:
+    static const bool value = decltype(Test<B>(nullptr))::value;
+};
+
+// holds the key as a base subobject so that it is constructed (possibly in
+// place, from Emplace arguments) before NodeBaseType, whose constructor takes
+// a reference to the finished key
+template <typename ValueType> struct AVLNodeKeyHolder
+{
+    template <class... Args>
+    AVLNodeKeyHolder( Args&&... args ) : key( std::forward<Args>(args)... ) {}
+    ValueType key;
+};
+
+// the default node allocation policy: every node comes from the global heap
+struct NewDeleteNodeAllocator
+{
+    static void* Allocate( size_t n ) { return ::operator new(n); }
+    static void Deallocate( void* p, size_t ) { ::operator delete(p); }
+};
+
+// a slab allocator that hands out fixed-size blocks carved from large slabs and
+// recycles freed blocks through a free list, so node churn never touches the
+// global heap after the slabs are warm.
+// All blocks requested through one instantiation must have the same size; use a
+// distinct Tag per node type if several differently-sized trees share a program.
+// Slab memory is only returned to the heap by ReleaseAll(), which must not be
+// called while any tree still owns nodes from this pool.
+// Like the rest of this code, the pool is not thread-safe.
+template <typename Tag = void, size_t NodesPerSlab = 1024> class PoolNodeAllocator
+{
+public:
+    static void* Allocate( size_t n )
+    {
+        State& s = GetState();
+        assert( s.blockSize == 0 || s.blockSize == n );
+
+        if( s.freeList )
+        {
+            FreeBlock* p = s.freeList;
+            s.freeList = p->next;
+            return p;
+        }
+
+        if( s.slabUsed == NodesPerSlab || s.slabs.empty() )
+        {
+            s.blockSize = n;
+            s.slabs.emplace_back( new char[n * NodesPerSlab] );
+            s.slabUsed = 0;
+        }
+
+        return s.slabs.back().get() + (s.slabUsed++) * n;
+    }
+
+    static void Deallocate( void* p, size_t )
+    {
+        State& s = GetState();
+        FreeBlock* b = static_cast<FreeBlock*>(p);
+        b->next = s.freeList;
+        s.freeList = b;
+    }
+
+    static void ReleaseAll()
+    {
+        State& s = GetState();
+        s.slabs.clear();
+        s.freeList = nullptr;
+        s.slabUsed = 0;
+        s.blockSize = 0;
+    }
+
+private:
+    struct FreeBlock { FreeBlock* next; };
+
+    struct State
+    {
+        State() : freeList(nullptr), slabUsed(0), blockSize(0) {}
+        std::vector<std::unique_ptr<char[]>> slabs;
+        FreeBlock* freeList;
+        size_t slabUsed;
+        size_t blockSize;
+    };
+
+    static State& GetState()
+    {
+        static State s;
+        return s;
+    }
+};
+
+// counters reported by AVLTree::GetStats(). Rebalance path lengths are
+// exported as a (calls, visited nodes) pair so the scraper can derive the
+// average path length per structural update.
+struct AVLStatsSnapshot
+{
+    AVLStatsSnapshot()
+        : comparisons(0), singleRotations(0), doubleRotations(0),
+          rebalanceCalls(0), rebalanceVisits(0), allocations(0) {}
+
+    size_t comparisons;      // comparator invocations on the descent paths
+    size_t singleRotations;
+    size_t doubleRotations;
+    size_t rebalanceCalls;   // structural updates that walked a root path
+    size_t rebalanceVisits;  // nodes visited across all those walks
+    size_t allocations;      // nodes allocated (including rejected duplicates)
+};
+
+// the default stats policy: every hook is an empty inline function, so the
+// instrumented call sites compile to exactly the uninstrumented code
+struct NullTreeStats
+{
+    void OnComparison() {}
+    void OnSingleRotation() {}
+    void OnDoubleRotation() {}
+    void OnRebalanceCall() {}
+    void OnRebalanceVisit() {}
+    void OnAllocation() {}
+    void Reset() {}
+    AVLStatsSnapshot GetSnapshot() const { return AVLStatsSnapshot(); }
+};
+
+// opt-in stats policy that keeps live per-tree counters; plug it in as the
+// StatsPolicy template parameter and scrape the numbers via GetStats()
+class CountingTreeStats
+{
+public:
+    void OnComparison() { ++m_s.comparisons; }
+    void OnSingleRotation() { ++m_s.singleRotations; }
+    void OnDoubleRotation() { ++m_s.doubleRotations; }
+    void OnRebalanceCall() { ++m_s.rebalanceCalls; }
+    void OnRebalanceVisit() { ++m_s.rebalanceVisits; }
+    void OnAllocation() { ++m_s.allocations; }
+    void Reset() { m_s = AVLStatsSnapshot(); }
+    AVLStatsSnapshot GetSnapshot() const { return m_s; }
+
+private:
+    AVLStatsSnapshot m_s;
+};
+
+template <typename T, typename Comparer = std::less<T>, class NodeBaseType = DefaultNodeBaseType<T>, class NodeAllocator = NewDeleteNodeAllocator, class StatsPolicy = NullTreeStats> class AVLTree
 {
 public:
     typedef T ValueType;
     typedef Comparer ComparerType;
 
-    class Node : public NodeBaseType 
+    class Node;
+
+private:
+    // runs the node destructor and hands the memory back to NodeAllocator;
+    // stateless, so NodePtr stays the size of a raw pointer
+    struct NodeDeleter
+    {
+        void operator()( Node* p ) const
+        {
+            p->~Node();
+            NodeAllocator::Deallocate( p, sizeof(Node) );
+        }
+    };
+
+public:
+    typedef std::unique_ptr<Node, NodeDeleter> NodePtr;
+
+    class Node : private AVLNodeKeyHolder<T>, public NodeBaseType
     {
         friend class AVLTree;
     public:
         size_t GetHeight() const { return height; }
         const T& GetKey() const { return key; }
         const Node* GetChild( size_t i ) const { return children[i].get(); }
-        const Node* GetParent() const { return parent; }        
+        const Node* GetParent() const { return parent; }
     private:
-        Node(const T& v) : NodeBaseType(v), height(1), key(v), parent(nullptr) {}
-        
+        using AVLNodeKeyHolder<T>::key;
+
+        template <class... Args>
+        Node( Args&&... args )
+            : AVLNodeKeyHolder<T>( std::forward<Args>(args)... ),
+              NodeBaseType( this->key ), height(1), parent(nullptr) {}
+
         void UpdateNodeState() {
             height = 1;
             size_t lh = 0, rh = 0;
@@ -44,57 +268,64 @@ public:
         }
         
         size_t height;
-        T key;
         Node* parent;
-        std::unique_ptr<Node> children[2];
+        NodePtr children[2];
     };
    
 private:
-    std::unique_ptr<Node>* GetFromParentPointer(Node* p)
+    // The split/merge internals below work on bare NodePtr root slots rather
+    // than AVLTree objects, so a Split builds no intermediate tree shells and
+    // copies no comparators on its way up the spine — with a stateful
+    // comparator (say, one holding a collation table) the old shell-per-level
+    // formulation paid a copy and its allocations at every step. The root
+    // slot is threaded through explicitly because Rebalance and the rotations
+    // must know which slot a parentless node hangs from.
+
+    static NodePtr* GetFromParentPointer( Node* p, NodePtr& root )
     {
         if( !p->parent )
-            return &m_root;
+            return &root;
         else if ( p->parent->children[0].get() == p )
             return &(p->parent->children[0]);
         else
             return &(p->parent->children[1]);
     }
-    
+
+    NodePtr* GetFromParentPointer(Node* p) { return GetFromParentPointer( p, m_root ); }
+
     void CheckedSetParent( Node* child, Node* parent )
     {
         if( child )
             child->parent = parent;
     }
-    
-    AVLTree( std::unique_ptr<Node> p, const ComparerType& comp ) : m_comp(comp) { m_root.swap(p); }
-    
-    std::unique_ptr<Node> ExtractMax()
+
+    NodePtr ExtractMaxFrom( NodePtr& root )
     {
-        assert( m_root ); // tree must be non-empty
-        Node* p = m_root.get();
+        assert( root ); // tree must be non-empty
+        Node* p = root.get();
         while( p->children[1] )
             p = p->children[1].get();
-            
-        std::unique_ptr<Node>* fromParent = GetFromParentPointer(p);
+
+        NodePtr* fromParent = GetFromParentPointer(p, root);
         Node* parent = p->parent;
-        std::unique_ptr<Node> tmp;
-        
+        NodePtr tmp;
+
         CheckedSetParent(p->children[0].get(), parent);
-        
+
         tmp.swap( p->children[0] );
         tmp.swap( *fromParent );
-        
+
         tmp->parent = nullptr;
-        Rebalance(parent);
-        
+        Rebalance(parent, root);
+
         return tmp;
     }
-    
+
     void SetRootAndTwoSubtrees(
-        std::unique_ptr<Node>& fromParent,
-        std::unique_ptr<Node> newNode,
-        std::unique_ptr<Node> child1,
-        std::unique_ptr<Node> child2,
+        NodePtr& fromParent,
+        NodePtr newNode,
+        NodePtr child1,
+        NodePtr child2,
         Node* parent )
     {
         CheckedSetParent( child1.get(), newNode.get() );
@@ -108,24 +339,26 @@ private:
         fromParent->UpdateNodeState();
     }
     
-    void MergeWithRoot( std::unique_ptr<Node> root, AVLTree& rightTree )
+    // joins left + root + right (root is a single detached node whose key
+    // separates the two subtrees) and leaves the result in left
+    void JoinRoots( NodePtr& left, NodePtr root, NodePtr& right )
     {
         assert(root && !root->children[0] && !root->children[1]);
-        
-        size_t h1 = m_root ? m_root->height : 0;
-        size_t h2 = rightTree.m_root ? rightTree.m_root->height : 0;
-            
+
+        size_t h1 = left ? left->height : 0;
+        size_t h2 = right ? right->height : 0;
+
         if( h1 + 1 >= h2 && h1 <= h2 + 1 )
         {
-            SetRootAndTwoSubtrees( m_root, move(root), move(m_root), move(rightTree.m_root), nullptr );
+            SetRootAndTwoSubtrees( left, move(root), move(left), move(right), nullptr );
             return;
         }
-        
-        std::unique_ptr<Node>* treeToHang =     (h1 > h2) ? &(rightTree.m_root) : &m_root; // pointer to the smaller tree
+
+        NodePtr* treeToHang =     (h1 > h2) ? &right : &left; // pointer to the smaller tree
         size_t dir =                            (h1 > h2) ? 1 : 0; // direction where to descend along the other tree
         size_t hMin =                           (h1 > h2) ? h2 : h1;
-        Node* p =                               (h1 > h2) ? m_root.get() : rightTree.m_root.get();
-        
+        Node* p =                               (h1 > h2) ? left.get() : right.get();
+
         while( true )
         {
             size_t hNext = 0;
@@ -133,14 +366,14 @@ private:
                 hNext = p->children[dir]->height;
             if( hMin + 1 == hNext || hNext == hMin )
             {
-                std::unique_ptr<Node> child1( dir == 0 ? move(*treeToHang) : move(p->children[dir]) );
-                std::unique_ptr<Node> child2( dir == 1  ? move(*treeToHang) : move(p->children[dir]) );
+                NodePtr child1( dir == 0 ? move(*treeToHang) : move(p->children[dir]) );
+                NodePtr child2( dir == 1  ? move(*treeToHang) : move(p->children[dir]) );
                 SetRootAndTwoSubtrees( p->children[dir], move(root), move(child1), move(child2), p );
-                
+
                 if( h1 < h2 )
-                    m_root.swap( rightTree.m_root );
+                    left.swap( right );
 
-                Rebalance(p);
+                Rebalance(p, left);
                 return;
             }
             else
@@ -148,82 +381,218 @@ private:
         }
     }
 
+    // full merge of two root slots (all keys of left below all keys of
+    // right); the result lands in left and right is emptied
+    void MergeRoots( NodePtr& left, NodePtr& right )
+    {
+        if( !left )
+        {
+            left.swap(right);
+            return;
+        }
+
+        JoinRoots( left, ExtractMaxFrom(left), right );
+    }
+
+    template <class... Args>
+    NodePtr MakeNode( Args&&... args )
+    {
+        m_stats.OnAllocation();
+        void* mem = NodeAllocator::Allocate( sizeof(Node) );
+        try
+        {
+            return NodePtr( new(mem) Node( std::forward<Args>(args)... ) );
+        }
+        catch(...)
+        {
+            NodeAllocator::Deallocate( mem, sizeof(Node) );
+            throw;
+        }
+    }
+
+    // attaches an already-constructed node; destroys it and returns false if
+    // an equal key is already present
+    bool AddNode( NodePtr node )
+    {
+        if( !m_root )
+        {
+            m_root = move(node);
+            return true;
+        }
+
+        Node* where = Find( node->key );
+        size_t dir;
+        if( Less(node->key, where->key) )
+            dir = 0;
+        else if( Less(where->key, node->key) )
+            dir = 1;
+        else // value already present
+            return false;
+
+        assert( !where->children[dir] );
+        node->parent = where;
+        where->children[dir] = move(node);
+        LinkInsertedNode( where->children[dir].get(), where, dir, OrderedLinksTag() );
+
+        where->UpdateNodeState();
+        Rebalance( where->parent );
+
+        return true;
+    }
+
+    // the insertion tail shared by Add and AddHint: where is the last node a
+    // descent for v touched, so v either equals its key or belongs in its
+    // empty child slot
+    bool AddAtLocation( Node* where, const T& v )
+    {
+        size_t dir;
+        if( Less(v, where->key) )
+            dir = 0;
+        else if( Less(where->key, v) )
+            dir = 1;
+        else // value already present
+            return false;
+
+        AddChild( where, dir, v );
+        LinkInsertedNode( where->children[dir].get(), where, dir, OrderedLinksTag() );
+
+        where->UpdateNodeState();
+        Rebalance( where->parent );
+
+        return true;
+    }
+
+    // Climbs from hint to the lowest ancestor whose subtree is known to
+    // bracket v, i.e. the node a root descent for v would also pass through.
+    // Each step compares v against the parent's key, which lies inside the
+    // subtree climbed into, so it is a permanent witness that the subtree
+    // holds a key <= v (okLo) or >= v (okHi); once both witnesses exist the
+    // root descent for v provably enters this subtree and the climb stops.
+    Node* HintAncestor( Node* hint, const T& v ) const
+    {
+        if( !hint )
+            return m_root.get();
+
+        Node* p = hint;
+        bool okLo = false, okHi = false;
+        while( p->parent && !(okLo && okHi) )
+        {
+            Node* par = p->parent;
+            if( p == par->children[0].get() )
+            {
+                if( Less(v, par->key) )
+                    okHi = true;
+                else
+                    okLo = true;
+            }
+            else
+            {
+                if( Less(par->key, v) )
+                    okLo = true;
+                else
+                    okHi = true;
+            }
+            p = par;
+        }
+        return p;
+    }
+
     void AddChild( Node* p, size_t dir, const T& v )
     {
         assert( !p->children[dir] );
-        p->children[dir].reset( new Node(v) );
+        p->children[dir] = MakeNode(v);
         p->children[dir]->parent = p;
     }
 
-    // moves the left and right subtrees into the separate trees and adds the node pointer to by p to the appropriate one
+    // moves the left and right subtrees into the separate root slots and adds the node pointed to by p to the appropriate one
     // returns (p has a parent) AND (p is the left child)
-    bool PrepareInitialSplittingState( Node* p, AVLTree& lt, AVLTree& rt, bool nodeGoesLeft )
+    bool PrepareInitialSplittingState( Node* p, NodePtr& lt, NodePtr& rt, bool nodeGoesLeft )
     {
-        lt.m_root.swap( p->children[0] );
-        CheckedSetParent(lt.m_root.get(), nullptr);
+        lt.swap( p->children[0] );
+        CheckedSetParent(lt.get(), nullptr);
 
-        rt.m_root.swap( p->children[1] );
-        CheckedSetParent(rt.m_root.get(), nullptr);
+        rt.swap( p->children[1] );
+        CheckedSetParent(rt.get(), nullptr);
+
+        NodePtr* fromParent = GetFromParentPointer(p);
+        assert( fromParent );
 
-        std::unique_ptr<Node>* fromParent = GetFromParentPointer(p);
-        assert( fromParent );       
-        
         bool res = (p->parent && p == p->parent->children[0].get());
-        
+
         p->parent = nullptr;
-        std::unique_ptr<Node> tmp;
-        tmp.swap( *fromParent );
-        
-        AVLTree midTree( move(tmp), GetComparer() );
-        assert( midTree.m_root );
-        midTree.m_root->UpdateNodeState();
+        NodePtr mid;
+        mid.swap( *fromParent );
+        assert( mid );
+        mid->UpdateNodeState();
+
         if( nodeGoesLeft )
-        {
-            lt.MergeWith(midTree);
-        }
+            MergeRoots( lt, mid );
         else
         {
-            midTree.MergeWith(rt);
-            midTree.Swap(rt);
+            MergeRoots( mid, rt );
+            rt.swap( mid );
         }
-        
+
         return res;
     }
-    
+
     // performs one step of the splitting procedure
     // merges the remaining child of p with lt or rt, as appropriate
     // returns whether p is a left child of its parent
-    bool DoOneSplittingStep( Node* p, bool isLeftChild, AVLTree& lt, AVLTree& rt )
+    bool DoOneSplittingStep( Node* p, bool isLeftChild, NodePtr& lt, NodePtr& rt )
     {
-        std::unique_ptr<Node>* fromParent = GetFromParentPointer(p);
+        NodePtr* fromParent = GetFromParentPointer(p);
         assert(fromParent);
         bool res = (p->parent && p == p->parent->children[0].get());
-        p->parent = nullptr;        
-        
+        p->parent = nullptr;
+
         size_t dir = isLeftChild ? 0 : 1;
-        
+
         assert( !p->children[dir] ); // the child should have already been removed
-        AVLTree mergedTree( GetComparer() );
-        mergedTree.m_root.swap( p->children[1-dir] );
-        CheckedSetParent(mergedTree.m_root.get(), nullptr);
-        
-        std::unique_ptr<Node> root;
+        NodePtr rest;
+        rest.swap( p->children[1-dir] );
+        CheckedSetParent(rest.get(), nullptr);
+
+        NodePtr root;
         root.swap( *fromParent );
         root->UpdateNodeState();
-        
-        if( isLeftChild )            
-            rt.MergeWithRoot(move(root), mergedTree);
+
+        if( isLeftChild )
+            JoinRoots( rt, move(root), rest );
         else
         {
-            mergedTree.MergeWithRoot(move(root), lt);
-            lt.Swap(mergedTree);
+            JoinRoots( rest, move(root), lt );
+            lt.swap( rest );
         }
         return res;
     }
 
-    void DeleteNoRightChild( std::unique_ptr<Node>* fromParent, Node* p )
+    // unlinks and destroys a node known to be in this tree; shared by the
+    // homogeneous and heterogeneous Delete overloads
+    void DeleteFound( Node* p )
+    {
+        UnlinkDeletedNode( p, OrderedLinksTag() );
+
+        NodePtr* fromParent = GetFromParentPointer(p);
+
+        if( p->children[1] )
+        {
+            Node* next = p->children[1].get();
+            while( next->children[0] )
+                next = next->children[0].get();
+
+            if( next == p->children[1].get() )
+                DeleteNextIsImmediateChild(fromParent, p, next);
+            else
+                DeleteNextNotImmediateChild(fromParent, p, next);
+        }
+        else
+            DeleteNoRightChild( fromParent, p );
+    }
+
+    void DeleteNoRightChild( NodePtr* fromParent, Node* p )
     {
-        std::unique_ptr<Node> tmp;
+        NodePtr tmp;
         tmp.swap( p->children[0] );
         tmp.swap( *fromParent );
         CheckedSetParent( (*fromParent).get(), p->parent );
@@ -231,28 +600,31 @@ private:
         Rebalance(p->parent);
     }
 
-    void DeleteNextIsImmediateChild( std::unique_ptr<Node>* fromParent, Node* p, Node* next )
+    void DeleteNextIsImmediateChild( NodePtr* fromParent, Node* p, Node* next )
     {
-        std::unique_ptr<Node> tmp;
+        NodePtr tmp;
         tmp.swap(p->children[1]);
         fromParent->swap( tmp );
         next->children[0].swap(p->children[0]);
         CheckedSetParent(next->children[0].get(), next);
         next->parent = p->parent;
-        Rebalance(next);    
+        // next takes over p's recorded height along with its position, so the
+        // upward pass compares against what the ancestors actually accounted for
+        next->height = p->height;
+        Rebalance(next);
     }
 
-    void DeleteNextNotImmediateChild(std::unique_ptr<Node>* fromParent, Node* p, Node* next )
+    void DeleteNextNotImmediateChild(NodePtr* fromParent, Node* p, Node* next )
     {
         Node* nextParent = next->parent;
-        std::unique_ptr<Node>* fromNextParent = GetFromParentPointer(next);                
+        NodePtr* fromNextParent = GetFromParentPointer(next);                
                 
         p->children[0].swap( next->children[0] );
         assert( !p->children[0] );
         CheckedSetParent(next->children[0].get(), next);
         // p and next have swapped their left children
      
-        std::unique_ptr<Node> tmp;           
+        NodePtr tmp;           
         tmp.swap(p->children[1]); // tmp now has the right child of p.
         assert(!p->children[1]);
                 
@@ -266,15 +638,74 @@ private:
                 
         tmp.swap(*fromParent);
         next->parent = p->parent;
-        
-        Rebalance(nextParent);    
+        // see DeleteNextIsImmediateChild: next inherits p's recorded height
+        next->height = p->height;
+
+        Rebalance(nextParent);
     }
 
 public:
     AVLTree() : m_root(nullptr), m_comp() {}
-    AVLTree( const Comparer& comp ) : m_root(nullptr), m_comp(comp) {}   
-    
+    AVLTree( const Comparer& comp ) : m_root(nullptr), m_comp(comp) {}
+
+    AVLTree( AVLTree&& other )
+        : m_root( move(other.m_root) ), m_comp( std::move(other.m_comp) ),
+          m_stats( std::move(other.m_stats) ) {}
+
+    AVLTree& operator=( AVLTree&& other )
+    {
+        if( this != &other )
+        {
+            Clear();
+            m_root = move(other.m_root);
+            m_comp = std::move(other.m_comp);
+            m_stats = std::move(other.m_stats);
+        }
+        return *this;
+    }
+
+    // the destructor goes through Clear() so that even trees of tens of
+    // millions of nodes never run the recursive unique_ptr destructor chain
+    ~AVLTree() { Clear(); }
+
+    // destroys all nodes iteratively in O(n) time and O(1) extra space
+    void Clear() { DestroyDetached( move(m_root) ); }
+
+    // detaches the whole tree and returns the owning handle, so a
+    // latency-critical thread can hand the structure to a background thread
+    // and pay none of the teardown cost itself. Destroy the handle with
+    // DestroyDetached; letting it go out of scope works too but runs the
+    // recursive destructor chain, which deep trees should avoid.
+    NodePtr DetachRoot() { return move(m_root); }
+
+    // iterative teardown of a detached tree: left children are rotated onto
+    // the right spine so no recursion (and no auxiliary memory) is needed
+    static void DestroyDetached( NodePtr root )
+    {
+        while( root )
+        {
+            if( root->children[0] )
+            {
+                NodePtr left = move(root->children[0]);
+                root->children[0] = move(left->children[1]);
+                left->children[1] = move(root);
+                root = move(left);
+            }
+            else
+                root = move(root->children[1]);
+        }
+    }
+
     const Comparer& GetComparer() const { return m_comp; }
+
+    // snapshot of the instrumentation counters. With the default
+    // NullTreeStats policy the snapshot is all zeros and the hooks in the hot
+    // paths compile away entirely; instantiate the tree with CountingTreeStats
+    // to get live numbers. Comparisons are counted on the descent paths
+    // (Find/bounds/Add/Delete/FindBatch), not in the bulk std::sort
+    // preprocessing of the batch operations.
+    AVLStatsSnapshot GetStats() const { return m_stats.GetSnapshot(); }
+    void ResetStats() { m_stats.Reset(); }
     
     const Node* GetRoot() const { return m_root.get(); }
     Node* GetRoot() { return m_root.get(); }
@@ -285,10 +716,10 @@ public:
     const Node* GetMax() const { return GetExtreme(1); }
     Node* GetMax() { return GetExtreme(1); }
     
-    const Node* GetNext( const Node* p ) const { return GetNextImpl( p, 1 ); }
+    const Node* GetNext( const Node* p ) const { return GetNextImpl( const_cast<Node*>(p), 1 ); }
     Node* GetNext( Node* p ) { return GetNextImpl(p,1); }
-    
-    const Node* GetPrev( const Node* p) const { return GetNextImpl( p, 0 ); }
+
+    const Node* GetPrev( const Node* p) const { return GetNextImpl( const_cast<Node*>(p), 0 ); }
     Node* GetPrev(Node* p) { return GetNextImpl( p, 0 ); }
     
     void Swap( AVLTree& other )
@@ -299,91 +730,388 @@ public:
     void MergeWith( AVLTree& t )
     {
         assert( !GetRoot() || !t.GetRoot() || GetMax()->GetKey() < t.GetMin()->GetKey());
-        if( !m_root )
-        {
-            Swap(t);
-            return;
-        }
-        
-        MergeWithRoot(ExtractMax(), t);
+        LinkTreesForMerge( t, OrderedLinksTag() );
+        MergeRoots( m_root, t.m_root );
     }
     
     AVLTree Split( Node* p, bool nodeGoesLeft = false )
     {
+        // the one comparator copy a Split still makes: the returned tree
+        // needs its own. The spine walk itself works on bare root slots and
+        // neither copies comparators nor allocates.
+        AVLTree rt( GetComparer() );
+
         if( !m_root )
-            return AVLTree( GetComparer() );
-        
+            return rt;
+
         if( !p )
             throw std::invalid_argument( "Split: the p argument must be non-null" );
-            
-        AVLTree lt(GetComparer()), rt(GetComparer());
+
+        NodePtr lt;
         Node* parent = p->parent;
-        bool isLeftChild = PrepareInitialSplittingState( p, lt, rt, nodeGoesLeft );
+        bool isLeftChild = PrepareInitialSplittingState( p, lt, rt.m_root, nodeGoesLeft );
 
         p = parent;
 
         while( p )
         {
             parent = p->parent;
-            bool nextLeftChild = DoOneSplittingStep( p, isLeftChild, lt, rt );            
+            bool nextLeftChild = DoOneSplittingStep( p, isLeftChild, lt, rt.m_root );
             isLeftChild = nextLeftChild;
             p = parent;
         }
-        
-        Swap(lt);
+
+        // the spine walk emptied m_root along the way
+        m_root = move(lt);
+        CutBoundaryAfterSplit( rt, OrderedLinksTag() );
         return rt;
     }
     
-    const Node* Find( const T& v ) const { return FindImpl( v, m_root.get() ); }
-    Node* Find( const T& v ) { return FindImpl( v, m_root.get() ); }    
-    
-    bool Add( const T& v )
+    // replaces the contents of the tree with the strictly ascending range
+    // [begin, end), building the tree bottom-up in a single O(n) pass instead
+    // of n O(log n) insertions. UpdateNodeState runs exactly once per node, in
+    // post-order, so augmented NodeBaseTypes are filled in correctly.
+    template <class Iterator>
+    void BuildFromSorted( Iterator begin, Iterator end )
     {
-        if( ! m_root )
+#ifndef NDEBUG
+        if( begin != end )
+            for( Iterator a = begin, b = begin; ++b != end; ++a )
+                assert( m_comp(*a, *b) ); // input must be sorted and free of duplicates
+#endif
+        m_root.reset();
+        m_root = BuildFromSortedImpl( begin, std::distance(begin, end) );
+        RelinkAllNodes( OrderedLinksTag() );
+    }
+
+    // removes the closed key interval [lo, hi] from the tree and returns it
+    // as a separate tree. A single call does the work of the Find + Split +
+    // Split + destroy pattern while walking the overlapping root paths only
+    // once each, and the returned tree can be destroyed on another thread.
+    AVLTree ExtractRange( const T& lo, const T& hi )
+    {
+        Node* first = LowerBound(lo);
+        if( !first || m_comp(hi, first->key) )
+            return AVLTree( GetComparer() ); // nothing falls inside [lo, hi]
+
+        AVLTree rest = Split( first, false ); // this: keys < lo, rest: keys >= lo
+        Node* past = rest.UpperBound(hi);
+        if( past )
         {
-            m_root.reset( new Node(v) );
-            return true;
+            AVLTree tail = rest.Split( past, false ); // rest: [lo, hi], tail: keys > hi
+            MergeWith( tail );
         }
-        
-        Node* where = Find(v);
-        if( m_comp(v, where->key) )            
-            AddChild( where, 0, v );        
-        else if( m_comp(where->key, v) )
-            AddChild( where, 1, v );
-        else // value already present
-            return false;
-            
-        where->UpdateNodeState();       
-        Rebalance( where->parent );
-            
-        return true;
+        return rest;
     }
 
-    bool Delete( const T& v )
+    // splits off everything from the k-th smallest element (0-based) upwards
+    // in a single size-guided descent plus one Split; the k-th element itself
+    // stays left when nodeGoesLeft is set. Requires a NodeBaseType exposing
+    // GetSize(), such as TreeSizeNodeBaseType. Throws std::invalid_argument
+    // when k is out of range.
+    AVLTree SplitAtIndex( size_t k, bool nodeGoesLeft = false )
     {
-        Node* p = Find(v);
-        if( !p || m_comp(v, p->key) || m_comp(p->key, v) )
+        static_assert( NodeBaseHasSize<NodeBaseType>::value,
+                       "SplitAtIndex requires a NodeBaseType exposing GetSize(), e.g. TreeSizeNodeBaseType" );
+        return Split( NodeAtIndex(k), nodeGoesLeft );
+    }
+
+    // returns the number of keys in the tree smaller than the key of p, i.e.
+    // the 0-based position of p in the sorted order, by climbing the parent
+    // pointers once. Requires a NodeBaseType exposing GetSize().
+    size_t GetRank( const Node* p ) const
+    {
+        static_assert( NodeBaseHasSize<NodeBaseType>::value,
+                       "GetRank requires a NodeBaseType exposing GetSize(), e.g. TreeSizeNodeBaseType" );
+        if( !p )
+            throw std::invalid_argument( "The handle does not represent a valid position within the tree." );
+
+        size_t rank = p->children[0] ? p->children[0]->GetSize() : 0;
+        while( p->parent )
+        {
+            if( p == p->parent->children[1].get() )
+                rank += 1 + ( p->parent->children[0] ? p->parent->children[0]->GetSize() : 0 );
+            p = p->parent;
+        }
+        return rank;
+    }
+
+    const Node* Find( const T& v ) const { return FindImpl( v, m_root.get() ); }
+    Node* Find( const T& v ) { return FindImpl( v, m_root.get() ); }
+
+    // heterogeneous lookups: with a transparent comparator (one exposing an
+    // is_transparent typedef, e.g. std::less<>) any probe type the comparator
+    // accepts can be searched for directly, without constructing a full T.
+    // This is what makes point lookups cheap when T bundles a large payload
+    // next to the key — see AVLMap.h. The overloads are SFINAE-gated exactly
+    // like the standard containers' so that ordinary comparators keep taking
+    // the const T& entry points above via an implicit conversion.
+    template <class K, class C = Comparer, class = typename C::is_transparent>
+    const Node* Find( const K& v ) const { return FindImpl( v, m_root.get() ); }
+    template <class K, class C = Comparer, class = typename C::is_transparent>
+    Node* Find( const K& v ) { return FindImpl( v, m_root.get() ); }
+
+    template <class K, class C = Comparer, class = typename C::is_transparent>
+    const Node* FindExact( const K& v ) const { return FindExactImpl(v); }
+    template <class K, class C = Comparer, class = typename C::is_transparent>
+    Node* FindExact( const K& v ) { return FindExactImpl(v); }
+
+    template <class K, class C = Comparer, class = typename C::is_transparent>
+    const Node* LowerBound( const K& v ) const { return LowerBoundImpl(v); }
+    template <class K, class C = Comparer, class = typename C::is_transparent>
+    Node* LowerBound( const K& v ) { return LowerBoundImpl(v); }
+
+    template <class K, class C = Comparer, class = typename C::is_transparent>
+    const Node* UpperBound( const K& v ) const { return UpperBoundImpl(v); }
+    template <class K, class C = Comparer, class = typename C::is_transparent>
+    Node* UpperBound( const K& v ) { return UpperBoundImpl(v); }
+
+    template <class K, class C = Comparer, class = typename C::is_transparent>
+    std::pair<const Node*, const Node*> EqualRange( const K& v ) const
+    {
+        std::pair<Node*, Node*> r = EqualRangeImpl(v);
+        return std::pair<const Node*, const Node*>( r.first, r.second );
+    }
+    template <class K, class C = Comparer, class = typename C::is_transparent>
+    std::pair<Node*, Node*> EqualRange( const K& v ) { return EqualRangeImpl(v); }
+
+    template <class K, class C = Comparer, class = typename C::is_transparent>
+    bool Delete( const K& v )
+    {
+        Node* p = FindImpl( v, m_root.get() );
+        if( !p || Less(v, p->key) || Less(p->key, v) )
             return false;
-        
-        std::unique_ptr<Node>* fromParent = GetFromParentPointer(p);
-        
-        if( p->children[1] )
+        DeleteFound(p);
+        return true;
+    }
+
+    // looks up n keys in one pass. The probes are processed as one sorted
+    // group that splits as the descent branches, so the upper-level nodes are
+    // touched once per group instead of once per key, and each level's
+    // children are prefetched before the comparator runs. out[i] corresponds
+    // to keys[i] and follows Find's convention: the node containing the key,
+    // or the last node touched when it is absent (nullptr for an empty tree).
+    void FindBatch( const T* keys, size_t n, const Node** out ) const
+    {
+        FindBatchDispatch( keys, n, const_cast<Node**>(out) );
+    }
+    void FindBatch( const T* keys, size_t n, Node** out ) { FindBatchDispatch( keys, n, out ); }
+
+    // looks up n independent keys by software pipelining the descents: a
+    // window of up to FindManyWindow lookups advances in lockstep, one level
+    // per turn, and each descent prefetches its next child before the window
+    // rotates onward, so the DRAM round-trips of the lookups overlap instead
+    // of serializing — each stall covers the window's other loads. Unlike
+    // FindBatch there is no sort and no reliance on the probes sharing upper
+    // tree levels, so it wins on scattered keys over large trees. out[i]
+    // follows Find's convention: the node containing keys[i], or the last
+    // node touched when it is absent (nullptr for an empty tree).
+    void FindMany( const T* keys, size_t n, const Node** out ) const
+    {
+        FindManyImpl( keys, n, const_cast<Node**>(out) );
+    }
+    void FindMany( const T* keys, size_t n, Node** out ) { FindManyImpl( keys, n, out ); }
+
+    // returns the node containing v, or nullptr when v is absent. Unlike
+    // Find, which hands back the last node touched, no re-testing by the
+    // caller is needed; the whole descent costs one comparison per level
+    // plus a single extra comparison at the end.
+    const Node* FindExact( const T& v ) const { return FindExactImpl(v); }
+    Node* FindExact( const T& v ) { return FindExactImpl(v); }
+
+    // returns the node with the smallest key that is not less than v, or
+    // nullptr if every key is smaller
+    const Node* LowerBound( const T& v ) const { return LowerBoundImpl(v); }
+    Node* LowerBound( const T& v ) { return LowerBoundImpl(v); }
+
+    // returns the node with the smallest key that is greater than v, or
+    // nullptr if no such key exists
+    const Node* UpperBound( const T& v ) const { return UpperBoundImpl(v); }
+    Node* UpperBound( const T& v ) { return UpperBoundImpl(v); }
+
+    // returns {LowerBound(v), UpperBound(v)} sharing a single descent; the
+    // pair brackets the (at most one, keys being unique) matching node
+    std::pair<const Node*, const Node*> EqualRange( const T& v ) const
+    {
+        std::pair<Node*, Node*> r = EqualRangeImpl(v);
+        return std::pair<const Node*, const Node*>( r.first, r.second );
+    }
+    std::pair<Node*, Node*> EqualRange( const T& v ) { return EqualRangeImpl(v); }
+    
+    bool Add( const T& v )
+    {
+        if( ! m_root )
         {
-            Node* next = p->children[1].get();
-            while( next->children[0] )
-                next = next->children[0].get();
-            
-            if( next == p->children[1].get() )
-                DeleteNextIsImmediateChild(fromParent, p, next);
+            m_root = MakeNode(v);
+            return true;
+        }
+
+        return AddAtLocation( Find(v), v );
+    }
+
+    // Hint-based entry points for workloads with key locality: instead of
+    // descending from the root they climb from hint only until the subtree
+    // around it is known to bracket v, then descend from there, the way
+    // std::map::insert(hint, v) works. A lookup d keys away from the hint
+    // touches O(log d) nodes instead of O(logN), so runs of nearby accesses
+    // stay within a few hot cache lines. The hint must be a node of this
+    // tree; a null hint falls back to the ordinary root descent, so callers
+    // can blindly pass the previous hit. Return conventions match
+    // Find/Add/Delete exactly.
+    const Node* FindFromHint( const Node* hint, const T& v ) const
+    {
+        return FindImpl( v, HintAncestor( const_cast<Node*>(hint), v ) );
+    }
+    Node* FindFromHint( Node* hint, const T& v )
+    {
+        return FindImpl( v, HintAncestor( hint, v ) );
+    }
+
+    bool AddHint( Node* hint, const T& v )
+    {
+        if( !m_root )
+        {
+            m_root = MakeNode(v);
+            return true;
+        }
+
+        return AddAtLocation( FindFromHint( hint, v ), v );
+    }
+
+    bool DeleteHint( Node* hint, const T& v )
+    {
+        Node* p = FindFromHint( hint, v );
+        if( !p || Less(v, p->key) || Less(p->key, v) )
+            return false;
+
+        DeleteFound(p);
+        return true;
+    }
+
+    bool Add( T&& v ) { return Emplace( std::move(v) ); }
+
+    // constructs the key in place inside the node from args, avoiding the
+    // copy that Add(const T&) makes. Note that the node has to be constructed
+    // before the key can be compared, so a rejected duplicate costs one node
+    // allocation and destruction.
+    template <class... Args>
+    bool Emplace( Args&&... args )
+    {
+        return AddNode( MakeNode( std::forward<Args>(args)... ) );
+    }
+
+    // inserts every key from [begin, end) and returns how many were actually
+    // added. The batch is sorted (and deduplicated) once up front; small
+    // batches are applied incrementally in ascending order, while batches
+    // comparable to the tree size rebuild the whole tree in one O(n+m) merge
+    // pass instead of paying a rebalance cascade per key.
+    template <class Iterator>
+    size_t AddBatch( Iterator begin, Iterator end )
+    {
+        std::vector<T> batch( begin, end );
+        SortAndDedupe( batch );
+        if( batch.empty() )
+            return 0;
+
+        if( !UseRebuildForBatch( batch.size() ) )
+        {
+            size_t added = 0;
+            for( T& v : batch )
+                if( Add( std::move(v) ) )
+                    ++added;
+            return added;
+        }
+
+        std::vector<T> cur;
+        MoveKeysOutInOrder( cur );
+
+        std::vector<T> merged;
+        merged.reserve( cur.size() + batch.size() );
+        size_t i = 0, j = 0;
+        while( i < cur.size() && j < batch.size() )
+        {
+            if( m_comp(cur[i], batch[j]) )
+                merged.push_back( std::move(cur[i++]) );
+            else if( m_comp(batch[j], cur[i]) )
+                merged.push_back( std::move(batch[j++]) );
+            else // key already present; keep the existing one
+            {
+                merged.push_back( std::move(cur[i++]) );
+                ++j;
+            }
+        }
+        for( ; i < cur.size(); ++i )
+            merged.push_back( std::move(cur[i]) );
+        for( ; j < batch.size(); ++j )
+            merged.push_back( std::move(batch[j]) );
+
+        size_t added = merged.size() - cur.size();
+        BuildFromSorted( std::make_move_iterator(merged.begin()), std::make_move_iterator(merged.end()) );
+        return added;
+    }
+
+    // removes every key from [begin, end) and returns how many were actually
+    // deleted; same batching strategy as AddBatch
+    template <class Iterator>
+    size_t DeleteBatch( Iterator begin, Iterator end )
+    {
+        std::vector<T> batch( begin, end );
+        SortAndDedupe( batch );
+        if( batch.empty() )
+            return 0;
+
+        if( !UseRebuildForBatch( batch.size() ) )
+        {
+            size_t deleted = 0;
+            for( const T& v : batch )
+                if( Delete(v) )
+                    ++deleted;
+            return deleted;
+        }
+
+        std::vector<T> cur;
+        MoveKeysOutInOrder( cur );
+
+        std::vector<T> kept;
+        kept.reserve( cur.size() );
+        size_t j = 0;
+        for( size_t i = 0; i < cur.size(); ++i )
+        {
+            while( j < batch.size() && m_comp(batch[j], cur[i]) )
+                ++j;
+            if( j < batch.size() && !m_comp(cur[i], batch[j]) )
+                ++j; // equal: drop this key
             else
-                DeleteNextNotImmediateChild(fromParent, p, next);
+                kept.push_back( std::move(cur[i]) );
         }
-        else
-            DeleteNoRightChild( fromParent, p );
-        
+
+        size_t deleted = cur.size() - kept.size();
+        BuildFromSorted( std::make_move_iterator(kept.begin()), std::make_move_iterator(kept.end()) );
+        return deleted;
+    }
+
+    bool Delete( const T& v )
+    {
+        Node* p = Find(v);
+        if( !p || Less(v, p->key) || Less(p->key, v) )
+            return false;
+
+        DeleteFound(p);
         return true;
     }
 
+    // brings every deferred aggregate up to date. Only available with a lazy
+    // NodeBaseType such as LazyAggregateNodeBaseType; the traversal descends
+    // only into dirty subtrees (mutations mark whole root paths, so clean
+    // nodes never hide dirty ones), making the cost proportional to the
+    // region touched since the last flush.
+    void FlushAggregates()
+    {
+        static_assert( NodeBaseHasLazyAggregates<NodeBaseType>::value,
+                       "FlushAggregates requires a lazy NodeBaseType, e.g. LazyAggregateNodeBaseType" );
+        FlushAggregatesImpl( m_root.get() );
+    }
+
     template <class Functor>
     void VisitInOrder( Functor f ) const
     {
@@ -402,7 +1130,134 @@ public:
         VisitPostOrderImpl( f, m_root.get() );
     }
 
+    // recursive reference implementations of the three traversals above:
+    // O(height) stack instead of O(1) space. They exist so tests can diff
+    // the iterative rewrites against the textbook formulation — the fuzz
+    // target does so on every validation pass.
+    template <class Functor>
+    void VisitInOrderRecursive( Functor f ) const
+    {
+        VisitInOrderRecursiveImpl( f, m_root.get() );
+    }
+
+    template <class Functor>
+    void VisitPreOrderRecursive( Functor f ) const
+    {
+        VisitPreOrderRecursiveImpl( f, m_root.get() );
+    }
+
+    template <class Functor>
+    void VisitPostOrderRecursive( Functor f ) const
+    {
+        VisitPostOrderRecursiveImpl( f, m_root.get() );
+    }
+
+    // applies f(const T&) in ascending order to exactly the keys in the
+    // closed interval [lo, hi], pruning every subtree that lies entirely
+    // outside it — the same descent GetRangeSum uses, generalized from
+    // summation to an arbitrary visitor. Touches O(logN + k) nodes for k
+    // keys reported, against O(N) for a filtering VisitInOrder or a
+    // parent-climb per element for Find + GetNext.
+    template <class Functor>
+    void VisitInRange( const T& lo, const T& hi, Functor f ) const
+    {
+        VisitInRangeImpl( m_root.get(), lo, hi, f );
+    }
+
+    // a resumable in-order traversal that fills caller-provided buffers one
+    // chunk at a time, so a snapshot writer can interleave tree walking with
+    // I/O (and release any surrounding lock between chunks) instead of
+    // running one monolithic VisitInOrder over the whole tree. The position
+    // is remembered through the parent pointers in O(1) space; each chunk
+    // costs O(n + logN). The cursor is a read-only view: any Add, Delete,
+    // Split or MergeWith on the tree invalidates it.
+    class InOrderCursor
+    {
+        friend class AVLTree;
+    public:
+        // copies up to n keys in ascending order into buf and advances;
+        // returns how many were written. A return value short of n (in
+        // particular 0) means the traversal is finished.
+        size_t FillNext( T* buf, size_t n )
+        {
+            size_t filled = 0;
+            while( filled < n && m_cur )
+            {
+                buf[filled++] = m_cur->GetKey();
+                m_cur = m_tree->GetNextDispatch( const_cast<Node*>(m_cur), 1, OrderedLinksTag() );
+            }
+            return filled;
+        }
+
+        bool AtEnd() const { return m_cur == nullptr; }
+
+        // the node the next FillNext call would emit first; nullptr at the end
+        const Node* GetPosition() const { return m_cur; }
+
+    private:
+        InOrderCursor( const AVLTree& t ) : m_tree(&t), m_cur( t.GetMin() ) {}
+
+        const AVLTree* m_tree;
+        const Node* m_cur;
+    };
+
+    // returns a cursor positioned at the smallest key
+    InOrderCursor GetInOrderCursor() const { return InOrderCursor(*this); }
+
 private:
+    void SortAndDedupe( std::vector<T>& batch ) const
+    {
+        std::sort( batch.begin(), batch.end(), m_comp );
+        const Comparer& comp = m_comp;
+        batch.erase(
+            std::unique( batch.begin(), batch.end(),
+                [&comp]( const T& a, const T& b ) { return !comp(a, b) && !comp(b, a); } ),
+            batch.end() );
+    }
+
+    // decides between the incremental and the rebuild batch strategies.
+    // The exact node count is not tracked, but 2^height bounds it from above,
+    // so the test is biased toward the (always safe) incremental path.
+    bool UseRebuildForBatch( size_t m ) const
+    {
+        size_t h = m_root ? m_root->height : 0;
+        if( h >= 8 * sizeof(size_t) - 1 )
+            return false;
+        return m >= ( (size_t(1) << h) / (h + 1) );
+    }
+
+    // moves the keys out of all nodes in ascending order and leaves the tree
+    // empty
+    void MoveKeysOutInOrder( std::vector<T>& out )
+    {
+        for( Node* p = GetMin(); p; p = GetNext(p) )
+            out.push_back( std::move(p->key) );
+        m_root.reset();
+    }
+
+    // consumes the next n elements of the iterator in order and returns a
+    // perfectly balanced subtree over them; recursion depth is O(log n)
+    template <class Iterator>
+    NodePtr BuildFromSortedImpl( Iterator& it, size_t n )
+    {
+        if( n == 0 )
+            return NodePtr();
+
+        size_t leftCount = n / 2;
+        NodePtr left = BuildFromSortedImpl( it, leftCount );
+        NodePtr node = MakeNode( *it );
+        ++it;
+        NodePtr right = BuildFromSortedImpl( it, n - leftCount - 1 );
+
+        CheckedSetParent( left.get(), node.get() );
+        CheckedSetParent( right.get(), node.get() );
+        node->children[0] = move(left);
+        node->children[1] = move(right);
+        node->UpdateNodeState();
+
+        return node;
+    }
+
     Node* GetExtreme( size_t dir ) const
     {
         if( !m_root )
@@ -415,11 +1270,104 @@ private:
         return p;
     }
     
-    Node* GetNextImpl(Node* cur, size_t dir) const
+    typedef std::integral_constant<bool, NodeBaseHasOrderedLinks<NodeBaseType>::value> OrderedLinksTag;
+
+    void LinkInsertedNode( Node*, Node*, size_t, std::false_type ) {}
+    void LinkInsertedNode( Node* node, Node* where, size_t dir, std::true_type )
+    {
+        // the new node is a child of 'where' in direction dir, so it slots in
+        // between 'where' and its old neighbour on that side
+        if( dir == 1 )
+        {
+            Node* next = static_cast<Node*>( where->GetSucc() );
+            where->SetSucc( node );
+            node->SetPred( where );
+            node->SetSucc( next );
+            if( next )
+                next->SetPred( node );
+        }
+        else
+        {
+            Node* prev = static_cast<Node*>( where->GetPred() );
+            where->SetPred( node );
+            node->SetSucc( where );
+            node->SetPred( prev );
+            if( prev )
+                prev->SetSucc( node );
+        }
+    }
+
+    void UnlinkDeletedNode( Node*, std::false_type ) {}
+    void UnlinkDeletedNode( Node* p, std::true_type )
+    {
+        Node* prev = static_cast<Node*>( p->GetPred() );
+        Node* next = static_cast<Node*>( p->GetSucc() );
+        if( prev )
+            prev->SetSucc( next );
+        if( next )
+            next->SetPred( prev );
+        p->SetSucc( nullptr );
+        p->SetPred( nullptr );
+    }
+
+    void LinkTreesForMerge( AVLTree&, std::false_type ) {}
+    void LinkTreesForMerge( AVLTree& t, std::true_type )
+    {
+        Node* lmax = GetMax();
+        Node* rmin = t.GetMin();
+        if( lmax && rmin )
+        {
+            lmax->SetSucc( rmin );
+            rmin->SetPred( lmax );
+        }
+    }
+
+    void CutBoundaryAfterSplit( AVLTree&, std::false_type ) {}
+    void CutBoundaryAfterSplit( AVLTree& rt, std::true_type )
+    {
+        Node* lmax = GetMax();
+        Node* rmin = rt.GetMin();
+        if( lmax )
+            lmax->SetSucc( nullptr );
+        if( rmin )
+            rmin->SetPred( nullptr );
+    }
+
+    void RelinkAllNodes( std::false_type ) {}
+    void RelinkAllNodes( std::true_type )
+    {
+        Node* prev = nullptr;
+        for( Node* p = GetMin(); p; p = StructuralNext(p, 1) )
+        {
+            p->SetPred( prev );
+            p->SetSucc( nullptr );
+            if( prev )
+                prev->SetSucc( p );
+            prev = p;
+        }
+    }
+
+    Node* GetNextImpl( Node* cur, size_t dir ) const
     {
         if( !cur )
             throw std::invalid_argument( "The handle does not represent a valid position within the tree." );
-        
+
+        return GetNextDispatch( cur, dir, OrderedLinksTag() );
+    }
+
+    Node* GetNextDispatch( Node* cur, size_t dir, std::true_type ) const
+    {
+        return static_cast<Node*>( dir == 1 ? cur->GetSucc() : cur->GetPred() );
+    }
+
+    Node* GetNextDispatch( Node* cur, size_t dir, std::false_type ) const
+    {
+        return StructuralNext( cur, dir );
+    }
+
+    // in-order neighbour computed from the tree structure alone
+    Node* StructuralNext(Node* cur, size_t dir) const
+    {
         Node* p = nullptr;
         if( cur->children[dir] )
         {
@@ -445,26 +1393,72 @@ private:
         return p;
     }
 
+    // the iterative traversals below use the parent pointers instead of the call
+    // stack, so they run in O(1) extra space and survive trees far deeper than
+    // the thread stack would allow. The recursive formulations they replaced
+    // live on behind the public Visit*Recursive reference methods.
+
+    static const Node* LeftmostDeepest( const Node* p )
+    {
+        while( true )
+        {
+            if( p->children[0] )
+                p = p->children[0].get();
+            else if( p->children[1] )
+                p = p->children[1].get();
+            else
+                return p;
+        }
+    }
+
     template <class Functor>
     void VisitInOrderImpl( Functor f, const Node* p ) const
     {
         if(!p)
             return;
-        
-        VisitInOrderImpl( f, p->children[0].get() );
-        f( p->key );        
-        VisitInOrderImpl( f, p->children[1].get() );
+
+        while( p->children[0] )
+            p = p->children[0].get();
+
+        while( p )
+        {
+            f( p->key );
+            if( p->children[1] )
+            {
+                p = p->children[1].get();
+                while( p->children[0] )
+                    p = p->children[0].get();
+            }
+            else
+            {
+                while( p->parent && p == p->parent->children[1].get() )
+                    p = p->parent;
+                p = p->parent;
+            }
+        }
     }
-    
+
     template <class Functor>
     void VisitPreOrderImpl( Functor f, const Node* p ) const
     {
         if(!p)
             return;
-        
-        f( p->key );
-        VisitPreOrderImpl( f, p->children[0].get() );
-        VisitPreOrderImpl( f, p->children[1].get() );
+
+        while( p )
+        {
+            f( p->key );
+            if( p->children[0] )
+                p = p->children[0].get();
+            else if( p->children[1] )
+                p = p->children[1].get();
+            else
+            {
+                // climb until there is an unvisited right sibling subtree
+                while( p->parent && ( p == p->parent->children[1].get() || !p->parent->children[1] ) )
+                    p = p->parent;
+                p = p->parent ? p->parent->children[1].get() : nullptr;
+            }
+        }
     }
 
     template <class Functor>
@@ -472,15 +1466,77 @@ private:
     {
         if(!p)
             return;
-        
-        VisitPostOrderImpl( f, p->children[0].get() );
-        VisitPostOrderImpl( f, p->children[1].get() );
+
+        p = LeftmostDeepest( p );
+        while( p )
+        {
+            f( p->key );
+            const Node* par = p->parent;
+            if( par && p == par->children[0].get() && par->children[1] )
+                p = LeftmostDeepest( par->children[1].get() );
+            else
+                p = par;
+        }
+    }
+
+    // the pruned range descent: the left child is entered only when p's key
+    // is not below lo (otherwise the whole left subtree is), the right child
+    // only when it is not above hi; at most two boundary paths plus the
+    // subtrees fully inside the interval are ever touched. Recursion depth is
+    // bounded by the tree height.
+    template <class Functor>
+    void VisitInRangeImpl( const Node* p, const T& lo, const T& hi, Functor& f ) const
+    {
+        if( !p )
+            return;
+
+        bool aboveLo = !Less( p->key, lo );
+        bool belowHi = !Less( hi, p->key );
+
+        if( aboveLo )
+            VisitInRangeImpl( p->children[0].get(), lo, hi, f );
+        if( aboveLo && belowHi )
+            f( p->key );
+        if( belowHi )
+            VisitInRangeImpl( p->children[1].get(), lo, hi, f );
+    }
+
+    template <class Functor>
+    void VisitInOrderRecursiveImpl( Functor f, const Node* p ) const
+    {
+        if(!p)
+            return;
+
+        VisitInOrderRecursiveImpl( f, p->children[0].get() );
         f( p->key );
+        VisitInOrderRecursiveImpl( f, p->children[1].get() );
     }
 
-    Node* RotateOnce( std::unique_ptr<Node>& p, size_t ic )
+    template <class Functor>
+    void VisitPreOrderRecursiveImpl( Functor f, const Node* p ) const
     {
-        std::unique_ptr<Node> tmp;
+        if(!p)
+            return;
+
+        f( p->key );
+        VisitPreOrderRecursiveImpl( f, p->children[0].get() );
+        VisitPreOrderRecursiveImpl( f, p->children[1].get() );
+    }
+
+    template <class Functor>
+    void VisitPostOrderRecursiveImpl( Functor f, const Node* p ) const
+    {
+        if(!p)
+            return;
+
+        VisitPostOrderRecursiveImpl( f, p->children[0].get() );
+        VisitPostOrderRecursiveImpl( f, p->children[1].get() );
+        f( p->key );
+    }
+
+    Node* RotateOnce( NodePtr& p, size_t ic )
+    {
+        NodePtr tmp;
         Node* oldParent = p->parent;
         Node* root = p.get();
         tmp.swap( p ); // tmp points to C
@@ -504,70 +1560,354 @@ private:
 //             D       E
 //                    F G
     // ic is the direction of the taller subtree
-    Node* DoRotations( Node* p, size_t ic ) // returns the new root of the subtree    
+    Node* DoRotations( Node* p, size_t ic, NodePtr& root ) // returns the new root of the subtree
     {
         size_t hD = p->children[ic]->children[ic] ? p->children[ic]->children[ic]->height : 0;
         size_t hE = p->children[ic]->children[1-ic] ? p->children[ic]->children[1-ic]->height : 0;
-        
-        std::unique_ptr<Node>* fromParent = GetFromParentPointer(p);
+
+        NodePtr* fromParent = GetFromParentPointer(p, root);
         
         if( hD < hE )
+        {
+            m_stats.OnDoubleRotation();
             RotateOnce(p->children[ic], 1-ic);
-            
+        }
+        else
+            m_stats.OnSingleRotation();
+
         Node* nr = RotateOnce(*fromParent, ic);
         nr->UpdateNodeState();
         return nr;
     }
 
-    void Rebalance( Node* p )
+    typedef std::integral_constant<bool, NodeBaseIsHeightOnly<NodeBaseType>::value> HeightOnlyTag;
+
+    void Rebalance( Node* p ) { Rebalance( p, m_root ); }
+
+    void Rebalance( Node* p, NodePtr& root )
     {
-        if(!p)
+        m_stats.OnRebalanceCall();
+        RebalanceDispatch( p, root, HeightOnlyTag() );
+    }
+
+    // the full root-path update: augmented NodeBaseTypes must refresh their
+    // aggregates at every ancestor even when the heights have stabilized
+    void RebalanceDispatch( Node* p, NodePtr& root, std::false_type )
+    {
+        while( p )
+        {
+            m_stats.OnRebalanceVisit();
+            size_t h[2] = {0};
+            for( size_t i = 0; i < 2; ++i )
+                if( p->children[i] )
+                    h[i] = p->children[i]->height;
+
+            bool rotated = false;
+            for( size_t i = 0; i < 2; ++i )
+                if( h[i] > h[1-i] + 1 )
+                {
+                    assert(h[i] == h[1-i] + 2);
+                    p = DoRotations( p, i, root );
+                    rotated = true;
+                }
+
+            if( !rotated )
+                p->UpdateNodeState();
+
+            p = p->parent;
+        }
+    }
+
+    // height-only NodeBaseTypes stop climbing as soon as a subtree's height
+    // comes out equal to what the parent last recorded: the ancestors' stored
+    // heights and balance factors are then already correct, so on deep trees
+    // an insert touches (and dirties) roughly half the nodes the full walk
+    // would. The reasoning holds for every Rebalance call site — the recorded
+    // heights above the modified subtree always describe the pre-modification
+    // tree, which satisfied the AVL invariant.
+    void RebalanceDispatch( Node* p, NodePtr& root, std::true_type )
+    {
+        while( p )
+        {
+            m_stats.OnRebalanceVisit();
+            size_t h[2] = {0};
+            for( size_t i = 0; i < 2; ++i )
+                if( p->children[i] )
+                    h[i] = p->children[i]->height;
+
+            size_t oldHeight = p->height;
+            bool rotated = false;
+            for( size_t i = 0; i < 2; ++i )
+                if( h[i] > h[1-i] + 1 )
+                {
+                    assert(h[i] == h[1-i] + 2);
+                    p = DoRotations( p, i, root ); // p is the updated new subtree root
+                    rotated = true;
+                }
+
+            if( !rotated )
+                p->UpdateNodeState();
+
+            if( p->height == oldHeight )
+                return;
+
+            p = p->parent;
+        }
+    }
+
+    // post-order refresh of dirty aggregates; recursion depth is bounded by
+    // the tree height
+    void FlushAggregatesImpl( Node* p )
+    {
+        if( !p || !p->IsAggregateDirty() )
             return;
-            
-        size_t h[2] = {0};
-        for( size_t i = 0; i < 2; ++i )
-            if( p->children[i] )
-                h[i] = p->children[i]->height;
-        
-        bool rotated = false;
-        for( size_t i = 0; i < 2; ++i )
-            if( h[i] > h[1-i] + 1 )
+
+        FlushAggregatesImpl( p->children[0].get() );
+        FlushAggregatesImpl( p->children[1].get() );
+        p->RefreshAggregate( p->key, p->children[0].get(), p->children[1].get() );
+    }
+
+    void FindBatchDispatch( const T* keys, size_t n, Node** out ) const
+    {
+        if( !m_root )
+        {
+            for( size_t i = 0; i < n; ++i )
+                out[i] = nullptr;
+            return;
+        }
+
+        std::vector<size_t> order(n);
+        for( size_t i = 0; i < n; ++i )
+            order[i] = i;
+        const Comparer& comp = m_comp;
+        std::sort( order.begin(), order.end(),
+            [keys, &comp]( size_t a, size_t b ) { return comp(keys[a], keys[b]); } );
+
+        FindBatchImpl( m_root.get(), keys, out, order.data(), order.data() + n );
+    }
+
+    // descends with the sorted probe group [b, e); recursion depth is bounded
+    // by the tree height
+    void FindBatchImpl( Node* p, const T* keys, Node** out, const size_t* b, const size_t* e ) const
+    {
+        // split the group into probes left of, equal to, and right of p's key
+        const size_t* lowEnd = std::partition_point( b, e,
+            [&]( size_t i ) { return Less(keys[i], p->key); } );
+        const size_t* highBegin = std::partition_point( lowEnd, e,
+            [&]( size_t i ) { return !Less(p->key, keys[i]); } );
+
+        for( const size_t* it = lowEnd; it != highBegin; ++it )
+            out[*it] = p;
+
+        Node* l = p->children[0].get();
+        Node* r = p->children[1].get();
+
+        // warm both next levels before the subgroup descents dive in
+        if( b != lowEnd && l )
+            AVL_PREFETCH(l);
+        if( highBegin != e && r )
+            AVL_PREFETCH(r);
+
+        if( b != lowEnd )
+        {
+            if( l )
+                FindBatchImpl( l, keys, out, b, lowEnd );
+            else
+                for( const size_t* it = b; it != lowEnd; ++it )
+                    out[*it] = p;
+        }
+        if( highBegin != e )
+        {
+            if( r )
+                FindBatchImpl( r, keys, out, highBegin, e );
+            else
+                for( const size_t* it = highBegin; it != e; ++it )
+                    out[*it] = p;
+        }
+    }
+
+    // in-flight descents FindMany keeps; sized to the number of outstanding
+    // cache misses a core typically sustains, not to the tree
+    static const size_t FindManyWindow = 8;
+
+    void FindManyImpl( const T* keys, size_t n, Node** out ) const
+    {
+        Node* root = m_root.get();
+        if( !root )
+        {
+            for( size_t i = 0; i < n; ++i )
+                out[i] = nullptr;
+            return;
+        }
+
+        Node* cur[FindManyWindow];
+        size_t idx[FindManyWindow];
+        size_t live = 0; // descents currently in the window
+        size_t next = 0; // next key to enter it
+
+        while( live < FindManyWindow && next < n )
+        {
+            cur[live] = root;
+            idx[live] = next++;
+            ++live;
+        }
+
+        while( live )
+        {
+            for( size_t s = 0; s < live; )
+            {
+                Node* p = cur[s];
+                Node* q = nullptr;
+                if( Less( keys[idx[s]], p->key ) )
+                    q = p->children[0].get();
+                else if( Less( p->key, keys[idx[s]] ) )
+                    q = p->children[1].get();
+
+                if( q )
+                {
+                    // the load of *q resolves while the other descents run
+                    AVL_PREFETCH(q);
+                    cur[s] = q;
+                    ++s;
+                    continue;
+                }
+
+                // found the key, or ran off the tree: either way p is the
+                // answer under Find's convention. Refill the slot from the
+                // pending keys (the root is hot; no prefetch needed) or
+                // shrink the window.
+                out[idx[s]] = p;
+                if( next < n )
+                {
+                    cur[s] = root;
+                    idx[s] = next++;
+                    ++s;
+                }
+                else
+                {
+                    --live;
+                    cur[s] = cur[live];
+                    idx[s] = idx[live];
+                }
+            }
+        }
+    }
+
+    // size-guided descent to the k-th smallest element (0-based)
+    Node* NodeAtIndex( size_t i )
+    {
+        Node* p = m_root.get();
+        if( !p || i >= p->GetSize() )
+            throw std::invalid_argument( "Index out of range" );
+
+        while( true )
+        {
+            size_t ls = p->children[0] ? p->children[0]->GetSize() : 0;
+            if( i < ls )
+                p = p->children[0].get();
+            else if( i == ls )
+                return p;
+            else
             {
-                assert(h[i] == h[1-i] + 2);
-                p = DoRotations( p, i );
-                rotated = true;
+                i -= ls + 1;
+                p = p->children[1].get();
             }
-        
-        if( !rotated )
-            p->UpdateNodeState();
-        
-        Rebalance(p->parent);
+        }
     }
 
-    Node* FindImpl( const T& v, Node* pNode ) const
+    // the descent impls below are templated on the probe type so the same
+    // code serves both the classic const T& entry points and the
+    // heterogeneous ones; K is T everywhere unless the comparator is
+    // transparent
+
+    template <class K>
+    Node* LowerBoundImpl( const K& v ) const
     {
-        if( pNode == nullptr )
-            return pNode;
-            
-        if( m_comp( v, pNode->key) )
+        Node* candidate = nullptr;
+        Node* p = m_root.get();
+        while( p )
         {
-            if( pNode->children[0] != nullptr )
-                return FindImpl( v, pNode->children[0].get() );
+            if( Less( p->key, v ) )
+                p = p->children[1].get();
             else
-                return pNode;
-        }        
-        if( m_comp( pNode->key, v ) )
+            {
+                candidate = p;
+                p = p->children[0].get();
+            }
+        }
+        return candidate;
+    }
+
+    template <class K>
+    Node* UpperBoundImpl( const K& v ) const
+    {
+        Node* candidate = nullptr;
+        Node* p = m_root.get();
+        while( p )
+        {
+            if( Less( v, p->key ) )
+            {
+                candidate = p;
+                p = p->children[0].get();
+            }
+            else
+                p = p->children[1].get();
+        }
+        return candidate;
+    }
+
+    template <class K>
+    Node* FindExactImpl( const K& v ) const
+    {
+        Node* candidate = LowerBoundImpl(v);
+        if( candidate && !Less( v, candidate->key ) )
+            return candidate;
+        return nullptr;
+    }
+
+    template <class K>
+    std::pair<Node*, Node*> EqualRangeImpl( const K& v ) const
+    {
+        Node* lb = LowerBoundImpl(v);
+        if( !lb || Less( v, lb->key ) )
+            return std::pair<Node*, Node*>( lb, lb );
+        return std::pair<Node*, Node*>( lb, GetNextDispatch( lb, 1, OrderedLinksTag() ) );
+    }
+
+    template <class K>
+    Node* FindImpl( const K& v, Node* pNode ) const
+    {
+        while( pNode )
         {
-            if( pNode->children[1] )
-                return FindImpl( v, pNode->children[1].get() );
+            size_t dir;
+            if( Less( v, pNode->key ) )
+                dir = 0;
+            else if( Less( pNode->key, v ) )
+                dir = 1;
             else
                 return pNode;
-        }        
+
+            if( !pNode->children[dir] )
+                return pNode;
+            pNode = pNode->children[dir].get();
+        }
         return pNode;
     }
     
-    std::unique_ptr<Node> m_root;
+    // instrumented comparator call; with NullTreeStats this inlines to a
+    // plain m_comp(a, b). Templated so the heterogeneous overloads can pass
+    // their probe type straight through to a transparent comparator.
+    template <class A, class B>
+    bool Less( const A& a, const B& b ) const
+    {
+        m_stats.OnComparison();
+        return m_comp(a, b);
+    }
+
+    NodePtr m_root;
     Comparer m_comp;
+    // mutable because read-only operations (Find and friends) also compare
+    mutable StatsPolicy m_stats;
 };
 
 #endif
@@ -0,0 +1,335 @@
+#ifndef AVL_TREE_COMPACT_H
+#define AVL_TREE_COMPACT_H
+
+#include <algorithm>
+#include <functional>
+#include <vector>
+#include <cstdint>
+#include <cassert>
+#include <stdexcept>
+
+// An alternative storage engine for the AVL tree, optimized for cache locality
+// rather than pointer flexibility. All nodes live contiguously in one vector
+// and refer to each other by 32-bit indices; the height fits in a single byte
+// (an AVL tree of 2^32 nodes is at most ~46 levels tall). Per-node metadata is
+// 13 bytes plus the key, roughly half the pointer-based AVLTree::Node, and a
+// descent touches one compact array instead of heap-scattered allocations.
+//
+// Positions are exposed as indices instead of node pointers. An index remains
+// valid until the next Delete (which compacts the vector by moving the last
+// node into the freed slot) or until a reallocation-free Add; call Reserve()
+// up front if you want stable storage across a known number of insertions.
+//
+// The compact engine intentionally supports only the core dictionary
+// operations: NodeBaseType augmentation, Split and MergeWith stay with the
+// pointer-based AVLTree.
+template <typename T, typename Comparer = std::less<T>> class AVLTreeCompact
+{
+public:
+    typedef T ValueType;
+    typedef Comparer ComparerType;
+    typedef uint32_t IndexType;
+
+    static const IndexType NullIndex = 0xFFFFFFFFu;
+
+    AVLTreeCompact() : m_rootIndex(NullIndex), m_comp() {}
+    AVLTreeCompact( const Comparer& comp ) : m_rootIndex(NullIndex), m_comp(comp) {}
+
+    const Comparer& GetComparer() const { return m_comp; }
+
+    size_t GetCount() const { return m_nodes.size(); }
+    void Reserve( size_t n ) { m_nodes.reserve(n); }
+
+    IndexType GetRoot() const { return m_rootIndex; }
+    const T& GetKey( IndexType i ) const { return m_nodes[i].key; }
+    size_t GetHeight( IndexType i ) const { return m_nodes[i].height; }
+    IndexType GetChild( IndexType i, size_t dir ) const { return m_nodes[i].children[dir]; }
+    IndexType GetParent( IndexType i ) const { return m_nodes[i].parent; }
+
+    IndexType GetMin() const { return GetExtreme(0); }
+    IndexType GetMax() const { return GetExtreme(1); }
+
+    IndexType GetNext( IndexType i ) const { return GetNextImpl(i, 1); }
+    IndexType GetPrev( IndexType i ) const { return GetNextImpl(i, 0); }
+
+    // returns the index of the node containing v, or the last node touched by
+    // the descent when v is absent (mirrors AVLTree::Find)
+    IndexType Find( const T& v ) const
+    {
+        IndexType cur = m_rootIndex;
+        while( cur != NullIndex )
+        {
+            const Node& n = m_nodes[cur];
+            size_t dir;
+            if( m_comp(v, n.key) )
+                dir = 0;
+            else if( m_comp(n.key, v) )
+                dir = 1;
+            else
+                return cur;
+
+            if( n.children[dir] == NullIndex )
+                return cur;
+            cur = n.children[dir];
+        }
+        return cur;
+    }
+
+    bool Add( const T& v )
+    {
+        if( m_nodes.size() >= size_t(NullIndex) )
+            throw std::length_error( "AVLTreeCompact: node count limit reached" );
+
+        if( m_rootIndex == NullIndex )
+        {
+            m_rootIndex = AppendNode(v, NullIndex);
+            return true;
+        }
+
+        IndexType where = Find(v);
+        size_t dir;
+        if( m_comp(v, m_nodes[where].key) )
+            dir = 0;
+        else if( m_comp(m_nodes[where].key, v) )
+            dir = 1;
+        else // value already present
+            return false;
+
+        IndexType fresh = AppendNode(v, where);
+        m_nodes[where].children[dir] = fresh;
+        Rebalance(where);
+
+        return true;
+    }
+
+    bool Delete( const T& v )
+    {
+        IndexType p = Find(v);
+        if( p == NullIndex || m_comp(v, m_nodes[p].key) || m_comp(m_nodes[p].key, v) )
+            return false;
+
+        if( m_nodes[p].children[0] != NullIndex && m_nodes[p].children[1] != NullIndex )
+        {
+            // two children: move the successor key into p and unlink the
+            // successor instead (it has no left child)
+            IndexType next = m_nodes[p].children[1];
+            while( m_nodes[next].children[0] != NullIndex )
+                next = m_nodes[next].children[0];
+            m_nodes[p].key = std::move( m_nodes[next].key );
+            p = next;
+        }
+
+        size_t dir = m_nodes[p].children[0] != NullIndex ? 0 : 1;
+        IndexType child = m_nodes[p].children[dir];
+        IndexType parent = m_nodes[p].parent;
+
+        ReplaceChild( parent, p, child );
+        if( child != NullIndex )
+            m_nodes[child].parent = parent;
+
+        Rebalance(parent);
+        FillHole(p);
+
+        return true;
+    }
+
+    // replaces the contents with the strictly ascending range [begin, end),
+    // building a perfectly balanced tree in one O(n) pass
+    template <class Iterator>
+    void BuildFromSorted( Iterator begin, Iterator end )
+    {
+        m_nodes.clear();
+        m_rootIndex = NullIndex;
+
+        size_t n = std::distance(begin, end);
+        if( n >= size_t(NullIndex) )
+            throw std::length_error( "AVLTreeCompact: node count limit reached" );
+
+        m_nodes.reserve(n);
+        m_rootIndex = BuildFromSortedImpl( begin, n, NullIndex );
+    }
+
+    template <class Functor>
+    void VisitInOrder( Functor f ) const
+    {
+        IndexType p = GetMin();
+        while( p != NullIndex )
+        {
+            f( m_nodes[p].key );
+            p = GetNextImpl(p, 1);
+        }
+    }
+
+private:
+    struct Node
+    {
+        Node( const T& v, IndexType par )
+            : key(v), parent(par), height(1)
+        {
+            children[0] = NullIndex;
+            children[1] = NullIndex;
+        }
+
+        T key;
+        IndexType parent;
+        IndexType children[2];
+        uint8_t height;
+    };
+
+    IndexType AppendNode( const T& v, IndexType parent )
+    {
+        m_nodes.push_back( Node(v, parent) );
+        return IndexType(m_nodes.size() - 1);
+    }
+
+    IndexType GetExtreme( size_t dir ) const
+    {
+        if( m_rootIndex == NullIndex )
+            return NullIndex;
+
+        IndexType p = m_rootIndex;
+        while( m_nodes[p].children[dir] != NullIndex )
+            p = m_nodes[p].children[dir];
+
+        return p;
+    }
+
+    IndexType GetNextImpl( IndexType cur, size_t dir ) const
+    {
+        if( cur == NullIndex )
+            throw std::invalid_argument( "The handle does not represent a valid position within the tree." );
+
+        if( m_nodes[cur].children[dir] != NullIndex )
+        {
+            IndexType p = m_nodes[cur].children[dir];
+            while( m_nodes[p].children[1-dir] != NullIndex )
+                p = m_nodes[p].children[1-dir];
+            return p;
+        }
+
+        IndexType p = cur;
+        while( m_nodes[p].parent != NullIndex )
+        {
+            IndexType par = m_nodes[p].parent;
+            if( p == m_nodes[par].children[1-dir] )
+                return par;
+            p = par;
+        }
+        return NullIndex;
+    }
+
+    void ReplaceChild( IndexType parent, IndexType oldChild, IndexType newChild )
+    {
+        if( parent == NullIndex )
+            m_rootIndex = newChild;
+        else if( m_nodes[parent].children[0] == oldChild )
+            m_nodes[parent].children[0] = newChild;
+        else
+            m_nodes[parent].children[1] = newChild;
+    }
+
+    uint8_t GetChildHeight( IndexType p, size_t dir ) const
+    {
+        IndexType c = m_nodes[p].children[dir];
+        return c == NullIndex ? 0 : m_nodes[c].height;
+    }
+
+    void UpdateHeight( IndexType p )
+    {
+        m_nodes[p].height = uint8_t(1 + std::max( GetChildHeight(p, 0), GetChildHeight(p, 1) ));
+    }
+
+    // ic is the direction of the taller subtree; returns the new subtree root
+    IndexType RotateOnce( IndexType root, size_t ic )
+    {
+        IndexType pivot = m_nodes[root].children[ic];
+        IndexType inner = m_nodes[pivot].children[1-ic];
+        IndexType parent = m_nodes[root].parent;
+
+        ReplaceChild( parent, root, pivot );
+        m_nodes[pivot].parent = parent;
+
+        m_nodes[pivot].children[1-ic] = root;
+        m_nodes[root].parent = pivot;
+
+        m_nodes[root].children[ic] = inner;
+        if( inner != NullIndex )
+            m_nodes[inner].parent = root;
+
+        UpdateHeight(root);
+        UpdateHeight(pivot);
+        return pivot;
+    }
+
+    IndexType DoRotations( IndexType p, size_t ic )
+    {
+        IndexType child = m_nodes[p].children[ic];
+        if( GetChildHeight(child, ic) < GetChildHeight(child, 1-ic) )
+            RotateOnce( child, 1-ic );
+
+        return RotateOnce( p, ic );
+    }
+
+    void Rebalance( IndexType p )
+    {
+        while( p != NullIndex )
+        {
+            uint8_t h0 = GetChildHeight(p, 0);
+            uint8_t h1 = GetChildHeight(p, 1);
+
+            if( h0 > h1 + 1 )
+                p = DoRotations( p, 0 );
+            else if( h1 > h0 + 1 )
+                p = DoRotations( p, 1 );
+            else
+                UpdateHeight(p);
+
+            p = m_nodes[p].parent;
+        }
+    }
+
+    // keeps the node vector dense: moves the last node into the freed slot and
+    // patches the links that referred to it
+    void FillHole( IndexType hole )
+    {
+        IndexType last = IndexType(m_nodes.size() - 1);
+        if( hole != last )
+        {
+            m_nodes[hole] = std::move( m_nodes[last] );
+            ReplaceChild( m_nodes[hole].parent, last, hole );
+            for( size_t i = 0; i < 2; ++i )
+                if( m_nodes[hole].children[i] != NullIndex )
+                    m_nodes[m_nodes[hole].children[i]].parent = hole;
+        }
+        m_nodes.pop_back();
+    }
+
+    template <class Iterator>
+    IndexType BuildFromSortedImpl( Iterator& it, size_t n, IndexType parent )
+    {
+        if( n == 0 )
+            return NullIndex;
+
+        size_t leftCount = n / 2;
+        // the left subtree is built before its parent slot exists, so its
+        // parent link is patched below
+        IndexType left = BuildFromSortedImpl( it, leftCount, NullIndex );
+        IndexType node = AppendNode( *it, parent );
+        ++it;
+        IndexType right = BuildFromSortedImpl( it, n - leftCount - 1, node );
+
+        m_nodes[node].children[0] = left;
+        if( left != NullIndex )
+            m_nodes[left].parent = node;
+        m_nodes[node].children[1] = right;
+        UpdateHeight(node);
+
+        return node;
+    }
+
+    std::vector<Node> m_nodes;
+    IndexType m_rootIndex;
+    Comparer m_comp;
+};
+
+#endif
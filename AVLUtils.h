@@ -21,6 +21,81 @@ private:
     size_t treeSize;
 };
 
+// Maintains doubly linked in-order succ/pred pointers through the nodes.
+// AVLTree detects this base at compile time and keeps the links current across
+// Add, Delete, Split and MergeWith, after which GetNext/GetPrev are a single
+// pointer dereference instead of a parent-pointer climb — a full ordered scan
+// becomes a linked-list walk. Rotations never change the in-order sequence, so
+// they cost nothing here; Split and MergeWith pay one extra O(logN) walk each
+// to fix the boundary links. Composes over another base via the Inner
+// parameter if further augmentation is needed.
+template <typename ValueType, class Inner = DefaultNodeBaseType<ValueType>> class LinkedNodeBaseType : public Inner
+{
+public:
+    LinkedNodeBaseType( const ValueType& v ) : Inner(v), succ(nullptr), pred(nullptr) {}
+
+    LinkedNodeBaseType* GetSucc() { return succ; }
+    const LinkedNodeBaseType* GetSucc() const { return succ; }
+    LinkedNodeBaseType* GetPred() { return pred; }
+    const LinkedNodeBaseType* GetPred() const { return pred; }
+
+    // link maintenance entry points for AVLTree; not meant to be called by
+    // user code
+    void SetSucc( LinkedNodeBaseType* p ) { succ = p; }
+    void SetPred( LinkedNodeBaseType* p ) { pred = p; }
+
+    void UpdateNodeState( const ValueType& v, LinkedNodeBaseType* p1, LinkedNodeBaseType* p2 )
+    {
+        Inner::UpdateNodeState( v, p1, p2 );
+    }
+
+private:
+    LinkedNodeBaseType* succ;
+    LinkedNodeBaseType* pred;
+};
+
+// Defers aggregate maintenance behind a dirty bit. Every structural change
+// just marks the node instead of recomputing the wrapped Inner aggregate, so
+// write bursts stop paying for expensive aggregates (histograms, large sums)
+// at every ancestor on every update. Call AVLTree::FlushAggregates() before
+// reading; it refreshes exactly the dirty region. The aggregate itself is
+// reached through GetAggregate() after a flush — note that the free functions
+// that read eager accessors directly (GetRangeSum, GetNthSmallest) do not see
+// through this wrapper.
+template <typename ValueType, class Inner> class LazyAggregateNodeBaseType
+{
+public:
+    LazyAggregateNodeBaseType( const ValueType& v ) : inner(v), dirty(false) {}
+
+    // called by the tree on every structural change; recomputation is
+    // deferred until FlushAggregates
+    void UpdateNodeState( const ValueType&, LazyAggregateNodeBaseType*, LazyAggregateNodeBaseType* )
+    {
+        dirty = true;
+    }
+
+    bool IsAggregateDirty() const { return dirty; }
+
+    // the wrapped aggregate; only meaningful when the node is not dirty
+    const Inner& GetAggregate() const
+    {
+        assert( !dirty );
+        return inner;
+    }
+
+    // refresh entry point for AVLTree::FlushAggregates; not meant to be
+    // called by user code
+    void RefreshAggregate( const ValueType& v, LazyAggregateNodeBaseType* p1, LazyAggregateNodeBaseType* p2 )
+    {
+        inner.UpdateNodeState( v, p1 ? &p1->inner : nullptr, p2 ? &p2->inner : nullptr );
+        dirty = false;
+    }
+
+private:
+    Inner inner;
+    bool dirty;
+};
+
 template <typename ValueType, typename SummationType=ValueType> class SumNodeBaseType
 {
 public:
@@ -34,18 +109,21 @@ public:
     {
         sum = v;
         if( p1 )
-            sum += p1->key;
+            sum += p1->sum;
         if( p2 )
-            sum += p2->key;
+            sum += p2->sum;
     }
     
 private:
     SumType sum;
 };
 
-    
+
+// recursive formulation of the pruned range-sum descent, kept as the
+// reference implementation; GetRangeSumRecursive below is the entry point,
+// and the fuzz target cross-checks it against the iterative GetRangeSum
 template <typename AVLTreeInstantiation>
-typename AVLTreeInstantiation::Node::SumType GetRangeSumImpl(
+typename AVLTreeInstantiation::Node::SumType GetRangeSumRecursiveImpl(
     const typename AVLTreeInstantiation::Node* p,
     bool knowMin,
     const typename AVLTreeInstantiation::ValueType& minV,
@@ -58,29 +136,209 @@ typename AVLTreeInstantiation::Node::SumType GetRangeSumImpl(
     using ST = typename AVLTreeInstantiation::Node::SumType;
     if(!p)
         return ST();
-        
+
     if( knowMin && knowMax && !comp(minV, l) && !comp(h, maxV) )
-        return p->sum;
-        
+        return p->GetSum();
+
     ST res = ST();
-    
+
     if( !comp(p->GetKey(), l) && !comp(h, p->GetKey()) )
         res += p->GetKey();
-    if( (!knowMin && comp(l, p->GetKey())) || !comp( min(p->GetKey(), h, comp), max(minV, l, comp) ) )
-        res += GetRangeSumImpl<AVLTreeInstantiation>( p->GetChild(0), knowMin, minV, true, p->GetKey(), l, h, comp );
-    if( (!knowMax && comp(p->GetKey(), h)) || !comp( min( maxV, h, comp ), max(p->GetKey(), l, comp) ) )
-        res += GetRangeSumImpl<AVLTreeInstantiation>( p->GetChild(1), true, p->GetKey(), knowMax, maxV, l, h, comp );
-    
+    if( (!knowMin && comp(l, p->GetKey())) || !comp( std::min(p->GetKey(), h, comp), std::max(minV, l, comp) ) )
+        res += GetRangeSumRecursiveImpl<AVLTreeInstantiation>( p->GetChild(0), knowMin, minV, true, p->GetKey(), l, h, comp );
+    if( (!knowMax && comp(p->GetKey(), h)) || !comp( std::min( maxV, h, comp ), std::max(p->GetKey(), l, comp) ) )
+        res += GetRangeSumRecursiveImpl<AVLTreeInstantiation>( p->GetChild(1), true, p->GetKey(), knowMax, maxV, l, h, comp );
+
     return res;
 }
 
+// reference entry point for the recursive range sum; the lb/ub arguments
+// double as the (unused until known) min/max seeds
+template <typename AVLTreeInstantiation>
+typename AVLTreeInstantiation::Node::SumType GetRangeSumRecursive(
+    const AVLTreeInstantiation& t,
+    const typename AVLTreeInstantiation::ValueType& lb,
+    const typename AVLTreeInstantiation::ValueType& ub)
+{
+    return GetRangeSumRecursiveImpl<AVLTreeInstantiation>(
+        t.GetRoot(), false, lb, false, ub, lb, ub, t.GetComparer() );
+}
+
+// The generic range-aggregate engine. An aggregate policy Agg supplies
+//
+//   typedef ... ResultType;
+//   static ResultType Identity();                 // neutral element
+//   static ResultType Lift( const ValueType& );   // one key's contribution
+//   static ResultType Combine( ResultType, ResultType );
+//   static ResultType Subtree( const Node* );     // cached whole-subtree value
+//
+// and QueryRange<Agg> runs one pruned descent, lifting the boundary keys and
+// folding in whole covered subtrees through the O(1) cached accessor. The
+// descent reaches subtrees in no particular order, so Combine must be
+// commutative as well as associative (sums, counts, min/max all are).
+// Several aggregates fold in one traversal via PairedAggregate.
+template <class Agg, typename AVLTreeInstantiation>
+typename Agg::ResultType QueryRange(
+    const AVLTreeInstantiation& t,
+    const typename AVLTreeInstantiation::ValueType& lb,
+    const typename AVLTreeInstantiation::ValueType& ub)
+{
+    typedef typename AVLTreeInstantiation::Node NodeT;
+    typedef typename Agg::ResultType RT;
+    typedef typename AVLTreeInstantiation::ValueType VT;
+    const typename AVLTreeInstantiation::ComparerType& comp = t.GetComparer();
+
+    // iterative version of the pruned descent. The knowMin/knowMax flags of the
+    // recursive formulation become null/non-null bound pointers (the bounds live
+    // in tree nodes, so the pointers stay valid). After the root the descent
+    // splits into at most two boundary paths, so the explicit stack stays O(log n).
+    struct Frame
+    {
+        const NodeT* p;
+        const VT* minV;
+        const VT* maxV;
+    };
+
+    RT res = Agg::Identity();
+    std::vector<Frame> stack;
+    stack.push_back( Frame{ t.GetRoot(), nullptr, nullptr } );
+
+    while( !stack.empty() )
+    {
+        Frame f = stack.back();
+        stack.pop_back();
+        const NodeT* p = f.p;
+        if( !p )
+            continue;
+
+        if( f.minV && f.maxV && !comp(*f.minV, lb) && !comp(ub, *f.maxV) )
+        {
+            // whole subtree inside [lb, ub]
+            res = Agg::Combine( std::move(res), Agg::Subtree(p) );
+            continue;
+        }
+
+        const VT& k = p->GetKey();
+        if( !comp(k, lb) && !comp(ub, k) )
+            res = Agg::Combine( std::move(res), Agg::Lift(k) );
+        if( f.minV ? !comp( std::min(k, ub, comp), std::max(*f.minV, lb, comp) ) : comp(lb, k) )
+            stack.push_back( Frame{ p->GetChild(0), f.minV, &k } );
+        if( f.maxV ? !comp( std::min(*f.maxV, ub, comp), std::max(k, lb, comp) ) : comp(k, ub) )
+            stack.push_back( Frame{ p->GetChild(1), &k, f.maxV } );
+    }
+
+    return res;
+}
+
+// range sum over a SumNodeBaseType-augmented tree
+template <typename AVLTreeInstantiation> struct SumRangeAggregate
+{
+    typedef typename AVLTreeInstantiation::Node NodeT;
+    typedef typename NodeT::SumType ResultType;
+
+    static ResultType Identity() { return ResultType(); }
+    static ResultType Lift( const typename AVLTreeInstantiation::ValueType& v ) { return v; }
+    static ResultType Combine( ResultType a, const ResultType& b )
+    {
+        a += b;
+        return a;
+    }
+    static ResultType Subtree( const NodeT* p ) { return p->GetSum(); }
+};
+
+// number of keys in the range, over a TreeSizeNodeBaseType-augmented tree
+template <typename AVLTreeInstantiation> struct CountRangeAggregate
+{
+    typedef typename AVLTreeInstantiation::Node NodeT;
+    typedef size_t ResultType;
+
+    static ResultType Identity() { return 0; }
+    static ResultType Lift( const typename AVLTreeInstantiation::ValueType& ) { return 1; }
+    static ResultType Combine( ResultType a, ResultType b ) { return a + b; }
+    static ResultType Subtree( const NodeT* p ) { return p->GetSize(); }
+};
+
+// Smallest key in the range as a (nonempty, key) pair; works with any
+// NodeBaseType because a subtree's smallest key is its leftmost node — no
+// cached field needed, at the price of an O(subtree height) walk per covered
+// subtree. Requires the ValueType and the Comparer to be default
+// constructible. MaxKeyRangeAggregate is the mirror image.
+template <typename AVLTreeInstantiation> struct MinKeyRangeAggregate
+{
+    typedef typename AVLTreeInstantiation::Node NodeT;
+    typedef typename AVLTreeInstantiation::ValueType VT;
+    typedef std::pair<bool, VT> ResultType;
+
+    static ResultType Identity() { return ResultType( false, VT() ); }
+    static ResultType Lift( const VT& v ) { return ResultType( true, v ); }
+    static ResultType Combine( ResultType a, ResultType b )
+    {
+        if( !a.first )
+            return b;
+        if( !b.first )
+            return a;
+        typename AVLTreeInstantiation::ComparerType comp;
+        return comp( b.second, a.second ) ? b : a;
+    }
+    static ResultType Subtree( const NodeT* p )
+    {
+        while( p->GetChild(0) )
+            p = p->GetChild(0);
+        return Lift( p->GetKey() );
+    }
+};
+
+template <typename AVLTreeInstantiation> struct MaxKeyRangeAggregate
+{
+    typedef typename AVLTreeInstantiation::Node NodeT;
+    typedef typename AVLTreeInstantiation::ValueType VT;
+    typedef std::pair<bool, VT> ResultType;
+
+    static ResultType Identity() { return ResultType( false, VT() ); }
+    static ResultType Lift( const VT& v ) { return ResultType( true, v ); }
+    static ResultType Combine( ResultType a, ResultType b )
+    {
+        if( !a.first )
+            return b;
+        if( !b.first )
+            return a;
+        typename AVLTreeInstantiation::ComparerType comp;
+        return comp( a.second, b.second ) ? b : a;
+    }
+    static ResultType Subtree( const NodeT* p )
+    {
+        while( p->GetChild(1) )
+            p = p->GetChild(1);
+        return Lift( p->GetKey() );
+    }
+};
+
+// folds two aggregates in the same descent; nest for more, e.g.
+// PairedAggregate<Sum, PairedAggregate<Count, Min>> computes all three in
+// one traversal instead of three
+template <class A1, class A2> struct PairedAggregate
+{
+    typedef std::pair<typename A1::ResultType, typename A2::ResultType> ResultType;
+
+    static ResultType Identity() { return ResultType( A1::Identity(), A2::Identity() ); }
+    template <typename V>
+    static ResultType Lift( const V& v ) { return ResultType( A1::Lift(v), A2::Lift(v) ); }
+    static ResultType Combine( ResultType a, ResultType b )
+    {
+        return ResultType( A1::Combine( std::move(a.first), std::move(b.first) ),
+                           A2::Combine( std::move(a.second), std::move(b.second) ) );
+    }
+    template <typename NodeT>
+    static ResultType Subtree( const NodeT* p ) { return ResultType( A1::Subtree(p), A2::Subtree(p) ); }
+};
+
 template <typename AVLTreeInstantiation>
 typename AVLTreeInstantiation::Node::SumType GetRangeSum(
     const AVLTreeInstantiation& t,
     const typename AVLTreeInstantiation::ValueType& lb,
     const typename AVLTreeInstantiation::ValueType& ub)
 {
-    return GetRangeSumImpl<AVLTreeInstantiation>( t.GetRoot(), false, lb, false, ub, lb, ub, t.GetComparer() );
+    return QueryRange<SumRangeAggregate<AVLTreeInstantiation>>( t, lb, ub );
 }
 
 template <typename AVLTreeInstantiation>
@@ -108,4 +366,118 @@ const AVLNode* GetNthSmallestImpl( const AVLNode* p, size_t i )
         return GetNthSmallestImpl( p->GetChild(1), i - ls -1 );
 }
 
+// Exhaustively rechecks the structural contract the rest of this library
+// relies on: every parent pointer agrees with the child link it came from,
+// keys are in strict BST order under the tree's own comparer, every stored
+// height matches a from-scratch recomputation with sibling heights differing
+// by at most one, and any cached aggregates (GetSize, GetSum) and in-order
+// links (GetSucc/GetPred) agree with the structure — each optional check is
+// detected at compile time and skipped for bases that lack it. Throws
+// std::logic_error naming the first violated invariant and returns the
+// measured height, so callers can additionally assert the AVL height bound.
+// O(N); meant for debug builds and the fuzz target, not production paths.
+template <typename AVLTreeInstantiation>
+size_t ValidateInvariants( const AVLTreeInstantiation& t )
+{
+    typedef typename AVLTreeInstantiation::Node NodeT;
+    typedef typename AVLTreeInstantiation::ValueType VT;
+
+    size_t count = 0;
+    size_t height = ValidateSubtree( t.GetRoot(), (const NodeT*)nullptr,
+                                     (const VT*)nullptr, (const VT*)nullptr,
+                                     t.GetComparer(), count );
+    ValidateOrderedLinks( t, count,
+        std::integral_constant<bool, NodeBaseHasOrderedLinks<NodeT>::value>() );
+    return height;
+}
+
+template <typename AVLNode>
+void ValidateNodeSize( const AVLNode* p, size_t subtreeCount, std::true_type )
+{
+    if( p->GetSize() != subtreeCount )
+        throw std::logic_error( "ValidateInvariants: cached GetSize() disagrees with the subtree's node count" );
+}
+template <typename AVLNode>
+void ValidateNodeSize( const AVLNode*, size_t, std::false_type ) {}
+
+template <typename AVLNode>
+void ValidateNodeSum( const AVLNode* p, std::true_type )
+{
+    typename AVLNode::SumType s( p->GetKey() );
+    if( p->GetChild(0) )
+        s += p->GetChild(0)->GetSum();
+    if( p->GetChild(1) )
+        s += p->GetChild(1)->GetSum();
+    if( !( s == p->GetSum() ) )
+        throw std::logic_error( "ValidateInvariants: cached GetSum() disagrees with the subtree's recomputed sum" );
+}
+template <typename AVLNode>
+void ValidateNodeSum( const AVLNode*, std::false_type ) {}
+
+// returns the verified height of the subtree at p; count accumulates nodes
+template <typename AVLNode, typename V, typename Comparer>
+size_t ValidateSubtree( const AVLNode* p, const AVLNode* parent,
+                        const V* lo, const V* hi, const Comparer& comp,
+                        size_t& count )
+{
+    if( !p )
+        return 0;
+
+    if( p->GetParent() != parent )
+        throw std::logic_error( "ValidateInvariants: a node's parent pointer does not point at its parent" );
+    if( lo && !comp( *lo, p->GetKey() ) )
+        throw std::logic_error( "ValidateInvariants: BST key order violated" );
+    if( hi && !comp( p->GetKey(), *hi ) )
+        throw std::logic_error( "ValidateInvariants: BST key order violated" );
+
+    size_t before = count;
+    ++count;
+    size_t hl = ValidateSubtree( p->GetChild(0), p, lo, &p->GetKey(), comp, count );
+    size_t hr = ValidateSubtree( p->GetChild(1), p, &p->GetKey(), hi, comp, count );
+
+    if( p->GetHeight() != 1 + ( hl > hr ? hl : hr ) )
+        throw std::logic_error( "ValidateInvariants: stored height disagrees with the recomputed height" );
+    if( ( hl > hr ? hl - hr : hr - hl ) > 1 )
+        throw std::logic_error( "ValidateInvariants: AVL balance violated, child heights differ by more than one" );
+
+    ValidateNodeSize( p, count - before,
+        std::integral_constant<bool, NodeBaseHasSize<AVLNode>::value>() );
+    ValidateNodeSum( p,
+        std::integral_constant<bool, NodeBaseHasSum<AVLNode>::value>() );
+    return p->GetHeight();
+}
+
+// walks the succ chain from the minimum, checking the links are mutual, in
+// strict key order, and reach exactly the nodes the structural walk counted
+template <typename AVLTreeInstantiation>
+void ValidateOrderedLinks( const AVLTreeInstantiation& t, size_t count, std::true_type )
+{
+    typedef typename AVLTreeInstantiation::Node NodeT;
+
+    const NodeT* p = t.GetRoot();
+    while( p && p->GetChild(0) )
+        p = p->GetChild(0);
+    if( p && p->GetPred() )
+        throw std::logic_error( "ValidateInvariants: the minimum node has a predecessor link" );
+
+    size_t seen = 0;
+    while( p )
+    {
+        ++seen;
+        const NodeT* next = static_cast<const NodeT*>( p->GetSucc() );
+        if( next )
+        {
+            if( static_cast<const NodeT*>( next->GetPred() ) != p )
+                throw std::logic_error( "ValidateInvariants: succ/pred links are not mutual" );
+            if( !t.GetComparer()( p->GetKey(), next->GetKey() ) )
+                throw std::logic_error( "ValidateInvariants: in-order links are out of key order" );
+        }
+        p = next;
+    }
+    if( seen != count )
+        throw std::logic_error( "ValidateInvariants: the in-order link chain does not reach every node" );
+}
+template <typename AVLTreeInstantiation>
+void ValidateOrderedLinks( const AVLTreeInstantiation&, size_t, std::false_type ) {}
+
 #endif
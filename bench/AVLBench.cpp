@@ -0,0 +1,202 @@
+// Benchmark driver for the AVL tree library.
+//
+// Measures throughput and tail latency of the core operations across a range
+// of tree sizes with both random and sequential key patterns. Build and run
+// with `make bench` from the repository root; pass tree sizes on the command
+// line to override the defaults, e.g.
+//
+//     bench/avlbench 1000 100000 10000000
+//
+// Each line reports the average cost per operation and the p50/p99 of the
+// per-operation latency sample.
+
+#include "AVLTree.h"
+#include "AVLUtils.h"
+#include "AVLTreeCompact.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+typedef std::chrono::steady_clock Clock;
+
+double NowNs()
+{
+    return std::chrono::duration<double, std::nano>( Clock::now().time_since_epoch() ).count();
+}
+
+struct LatencySample
+{
+    std::vector<double> ns;
+
+    void Record( double v ) { ns.push_back(v); }
+
+    double Percentile( double p )
+    {
+        if( ns.empty() )
+            return 0.0;
+        std::sort( ns.begin(), ns.end() );
+        size_t idx = size_t( p * double(ns.size() - 1) );
+        return ns[idx];
+    }
+};
+
+void Report( const char* name, const char* pattern, size_t n, size_t ops, double totalNs, LatencySample& lat )
+{
+    printf( "%-22s %-10s n=%-9zu %10.1f ns/op %12.2f Mop/s   p50=%-8.0f p99=%.0f\n",
+            name, pattern, n, totalNs / double(ops), double(ops) * 1e3 / totalNs,
+            lat.Percentile(0.50), lat.Percentile(0.99) );
+}
+
+std::vector<int> MakeKeys( size_t n, bool random, unsigned seed )
+{
+    std::vector<int> keys(n);
+    std::iota( keys.begin(), keys.end(), 0 );
+    if( random )
+        std::shuffle( keys.begin(), keys.end(), std::mt19937(seed) );
+    return keys;
+}
+
+// runs op(i) for i in [0, ops), timing every sampleEvery-th call individually
+template <class Op>
+void RunTimed( const char* name, const char* pattern, size_t n, size_t ops, Op op )
+{
+    const size_t sampleEvery = ops > 100000 ? ops / 100000 : 1;
+    LatencySample lat;
+
+    double start = NowNs();
+    for( size_t i = 0; i < ops; ++i )
+    {
+        if( i % sampleEvery == 0 )
+        {
+            double t0 = NowNs();
+            op(i);
+            lat.Record( NowNs() - t0 );
+        }
+        else
+            op(i);
+    }
+    double total = NowNs() - start;
+
+    Report( name, pattern, n, ops, total, lat );
+}
+
+volatile size_t g_sink; // defeats dead-code elimination of query results
+
+void BenchAddFindDelete( size_t n, bool random )
+{
+    const char* pattern = random ? "random" : "sequential";
+    std::vector<int> keys = MakeKeys( n, random, 42 );
+
+    AVLTree<int> t;
+    RunTimed( "Add", pattern, n, n, [&]( size_t i ) { t.Add( keys[i] ); } );
+
+    std::vector<int> probes = MakeKeys( n, true, 43 );
+    RunTimed( "Find", pattern, n, n, [&]( size_t i ) {
+        g_sink = size_t( t.Find( probes[i] )->GetKey() );
+    } );
+
+    std::vector<int> victims = MakeKeys( n, true, 44 );
+    RunTimed( "Delete", pattern, n, n, [&]( size_t i ) { t.Delete( victims[i] ); } );
+}
+
+void BenchCompactFind( size_t n )
+{
+    std::vector<int> keys = MakeKeys( n, false, 0 );
+    AVLTreeCompact<int> t;
+    t.BuildFromSorted( keys.begin(), keys.end() );
+
+    std::vector<int> probes = MakeKeys( n, true, 45 );
+    RunTimed( "CompactFind", "random", n, n, [&]( size_t i ) {
+        g_sink = size_t( t.GetKey( t.Find( probes[i] ) ) );
+    } );
+}
+
+void BenchBuildFromSorted( size_t n )
+{
+    std::vector<int> keys = MakeKeys( n, false, 0 );
+    AVLTree<int> t;
+    RunTimed( "BuildFromSorted", "sorted", n, 1, [&]( size_t ) {
+        t.BuildFromSorted( keys.begin(), keys.end() );
+    } );
+}
+
+void BenchSplitMerge( size_t n )
+{
+    typedef AVLTree<int> Tree;
+    std::vector<int> keys = MakeKeys( n, false, 0 );
+    Tree t;
+    t.BuildFromSorted( keys.begin(), keys.end() );
+
+    std::mt19937 rng(46);
+    const size_t ops = 1000;
+    RunTimed( "Split+MergeWith", "random", n, ops, [&]( size_t ) {
+        Tree::Node* p = t.Find( int(rng() % n) );
+        Tree right = t.Split( p );
+        t.MergeWith( right );
+    } );
+}
+
+void BenchRangeSum( size_t n )
+{
+    typedef AVLTree<long, std::less<long>, SumNodeBaseType<long>> Tree;
+    std::vector<long> keys(n);
+    std::iota( keys.begin(), keys.end(), 0L );
+    Tree t;
+    t.BuildFromSorted( keys.begin(), keys.end() );
+
+    std::mt19937 rng(47);
+    const size_t ops = 100000;
+    RunTimed( "GetRangeSum", "random", n, ops, [&]( size_t ) {
+        long lo = long( rng() % n );
+        long hi = lo + long( rng() % n ) / 4;
+        g_sink = size_t( GetRangeSum( t, lo, hi ) );
+    } );
+}
+
+void BenchNthSmallest( size_t n )
+{
+    typedef AVLTree<int, std::less<int>, TreeSizeNodeBaseType<int>> Tree;
+    std::vector<int> keys = MakeKeys( n, false, 0 );
+    Tree t;
+    t.BuildFromSorted( keys.begin(), keys.end() );
+
+    std::mt19937 rng(48);
+    const size_t ops = 1000000;
+    RunTimed( "GetNthSmallest", "random", n, ops, [&]( size_t ) {
+        g_sink = size_t( GetNthSmallest( t, rng() % n )->GetKey() );
+    } );
+}
+
+} // namespace
+
+int main( int argc, char** argv )
+{
+    std::vector<size_t> sizes;
+    for( int i = 1; i < argc; ++i )
+        sizes.push_back( size_t( std::atoll(argv[i]) ) );
+    if( sizes.empty() )
+        sizes = { 1000, 10000, 100000, 1000000 };
+
+    for( size_t n : sizes )
+    {
+        printf( "---- n = %zu ----\n", n );
+        BenchAddFindDelete( n, true );
+        BenchAddFindDelete( n, false );
+        BenchCompactFind( n );
+        BenchBuildFromSorted( n );
+        BenchSplitMerge( n );
+        BenchRangeSum( n );
+        BenchNthSmallest( n );
+    }
+
+    return 0;
+}
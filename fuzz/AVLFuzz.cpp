@@ -0,0 +1,145 @@
+#include "AVLTree.h"
+#include "AVLUtils.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <set>
+#include <stdexcept>
+#include <vector>
+
+// Structural property fuzzing: drives random interleavings of Add, Delete,
+// Split and MergeWith against a reference std::set and periodically rechecks
+// the full invariant set through ValidateInvariants, plus the AVL height
+// bound height <= 1.45*log2(n+2) — the property whose silent loss would only
+// show up in production as a p99 latency regression. Every validation pass
+// also diffs the iterative O(1)-space traversals (and, where the base caches
+// sums, the iterative range sum) against their recursive reference
+// formulations. Runs the same script over several NodeBaseTypes so the
+// aggregate- and link-maintenance paths are exercised too.
+// Usage: avlfuzz [steps] [seeds].
+
+template <class Tree>
+static void CheckTree( const Tree& t, const std::set<int>& ref )
+{
+    size_t h = ValidateInvariants( t );
+    if( (double)h > 1.45 * std::log2( (double)ref.size() + 2.0 ) )
+        throw std::logic_error( "measured height exceeds the AVL bound 1.45*log2(n+2)" );
+
+    std::vector<int> got;
+    got.reserve( ref.size() );
+    for( const typename Tree::Node* p = t.GetMin(); p; p = t.GetNext(p) )
+        got.push_back( p->GetKey() );
+    if( got != std::vector<int>( ref.begin(), ref.end() ) )
+        throw std::logic_error( "tree contents diverged from the reference set" );
+
+    // the iterative O(1)-space traversals must visit exactly what their
+    // recursive reference formulations visit, in the same order
+    std::vector<int> it, rec;
+    auto intoIt  = [&it]( const int& v ) { it.push_back(v); };
+    auto intoRec = [&rec]( const int& v ) { rec.push_back(v); };
+    t.VisitInOrder( intoIt );
+    t.VisitInOrderRecursive( intoRec );
+    if( it != rec )
+        throw std::logic_error( "iterative and recursive in-order traversals disagree" );
+    it.clear(); rec.clear();
+    t.VisitPreOrder( intoIt );
+    t.VisitPreOrderRecursive( intoRec );
+    if( it != rec )
+        throw std::logic_error( "iterative and recursive pre-order traversals disagree" );
+    it.clear(); rec.clear();
+    t.VisitPostOrder( intoIt );
+    t.VisitPostOrderRecursive( intoRec );
+    if( it != rec )
+        throw std::logic_error( "iterative and recursive post-order traversals disagree" );
+}
+
+// for sum-augmented bases, the iterative pruned range sum must agree with
+// its recursive reference formulation on a random interval
+template <class Tree>
+static void CrossCheckRangeSum( const Tree& t, std::mt19937& rng, std::true_type )
+{
+    int lo = (int)( rng() % 10000 ) - 100;
+    int hi = lo + (int)( rng() % 3000 );
+    if( GetRangeSum( t, lo, hi ) != GetRangeSumRecursive( t, lo, hi ) )
+        throw std::logic_error( "iterative and recursive range sums disagree" );
+}
+template <class Tree>
+static void CrossCheckRangeSum( const Tree&, std::mt19937&, std::false_type ) {}
+
+template <class Tree>
+static void FuzzOne( const char* name, unsigned seed, size_t steps )
+{
+    std::mt19937 rng( seed );
+    Tree t;
+    std::set<int> ref;
+
+    for( size_t i = 0; i < steps; ++i )
+    {
+        int v = (int)( rng() % 10000 );
+        switch( rng() % 8 )
+        {
+        case 0: case 1: case 2: case 3:
+            if( t.Add(v) != ref.insert(v).second )
+                throw std::logic_error( "Add disagreed with the reference set" );
+            break;
+        case 4: case 5: case 6:
+            if( t.Delete(v) != ( ref.erase(v) > 0 ) )
+                throw std::logic_error( "Delete disagreed with the reference set" );
+            break;
+        case 7: // split at a random present key, check both halves, merge back
+        {
+            if( ref.empty() )
+                break;
+            std::set<int>::iterator it = ref.lower_bound(v);
+            if( it == ref.end() )
+                --it;
+            int k = *it;
+            bool keyGoesLeft = rng() % 2 == 0;
+            Tree rt = t.Split( t.FindExact(k), keyGoesLeft );
+            std::set<int>::iterator cut = keyGoesLeft ? ref.upper_bound(k) : ref.find(k);
+            CheckTree( t, std::set<int>( ref.begin(), cut ) );
+            CheckTree( rt, std::set<int>( cut, ref.end() ) );
+            t.MergeWith( rt );
+            break;
+        }
+        }
+
+        if( i % 64 == 0 )
+        {
+            CheckTree( t, ref );
+            CrossCheckRangeSum( t, rng,
+                std::integral_constant<bool, NodeBaseHasSum<typename Tree::Node>::value>() );
+        }
+    }
+    CheckTree( t, ref );
+    std::printf( "  %-32s seed %u: %zu steps OK (final n=%zu)\n", name, seed, steps, ref.size() );
+}
+
+static void FuzzAll( unsigned seed, size_t steps )
+{
+    FuzzOne<AVLTree<int>>( "plain", seed, steps );
+    FuzzOne<AVLTree<int, std::less<int>, TreeSizeNodeBaseType<int>>>( "size-augmented", seed, steps );
+    FuzzOne<AVLTree<int, std::less<int>, SumNodeBaseType<int, long long>>>( "sum-augmented", seed, steps );
+    FuzzOne<AVLTree<int, std::less<int>, LinkedNodeBaseType<int, TreeSizeNodeBaseType<int>>>>( "linked+size", seed, steps );
+}
+
+int main( int argc, char** argv )
+{
+    size_t steps = argc > 1 ? (size_t)std::atoll( argv[1] ) : 20000;
+    unsigned seeds = argc > 2 ? (unsigned)std::atoi( argv[2] ) : 4;
+
+    try
+    {
+        for( unsigned s = 1; s <= seeds; ++s )
+            FuzzAll( s, steps );
+    }
+    catch( const std::exception& e )
+    {
+        std::fprintf( stderr, "FAILED: %s\n", e.what() );
+        return 1;
+    }
+    std::puts( "avlfuzz OK" );
+    return 0;
+}